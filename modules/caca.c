@@ -92,12 +92,15 @@ bool vlock_save(void **ctx_ptr)
     .stdin_fd = REDIRECT_DEV_NULL,
     .stdout_fd = NO_REDIRECT,
     .stderr_fd = NO_REDIRECT,
+    .name = "caca",
+    /* Start the demo again if it crashes. */
+    .restart = true,
   };
 
   /* Initialize ncurses. */
   initscr();
 
-  if (!create_child(&child))
+  if (!create_child(&child, NULL))
     return false;
 
   *ctx_ptr = &child;
@@ -0,0 +1,91 @@
+/* module-manifest.c -- print the manifest of a module for vlock,
+ *                      the VT locking program for linux
+ *
+ * This program is copyright (C) 2007 Frank Benkstein, and is free
+ * software which is freely distributable under the terms of the
+ * GNU General Public License version 2, included as the file COPYING in this
+ * distribution.  It is NOT public domain software, and any
+ * redistribution not permitted by the GNU General Public License is
+ * expressly forbidden without prior written permission from
+ * the author.
+ *
+ */
+
+/* This program is run when the modules are built.  It loads the given module
+ * and prints its dependencies and hooks in the same format a script prints
+ * when called with the "manifest" argument.  vlock reads the result instead
+ * of loading every module it is asked for. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <dlfcn.h>
+
+#include "plugin-names.h"
+
+static const char *dependency_names[] = {
+  FOR_EACH_DEPENDENCY(PLUGIN_NAME_STRING)
+  NULL
+};
+
+static const char *hook_names[] = {
+  FOR_EACH_HOOK(PLUGIN_NAME_STRING)
+  NULL
+};
+
+int main(int argc, char *argv[])
+{
+  void *dl_handle;
+  bool all_hooks = true;
+
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s module.so\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  /* Only the symbols are looked up and nothing is called.  Functions that
+   * only vlock-main provides are never resolved this way. */
+  dl_handle = dlopen(argv[1], RTLD_LAZY | RTLD_LOCAL);
+
+  if (dl_handle == NULL) {
+    fprintf(stderr, "%s: %s\n", argv[0], dlerror());
+    exit(EXIT_FAILURE);
+  }
+
+  printf("vlock-manifest 1\n");
+
+  for (size_t i = 0; dependency_names[i] != NULL; i++) {
+    const char *(*dependency)[] = dlsym(dl_handle, dependency_names[i]);
+
+    printf("%s:", dependency_names[i]);
+
+    for (size_t j = 0; dependency != NULL && (*dependency)[j] != NULL; j++)
+      printf(" %s", (*dependency)[j]);
+
+    printf("\n");
+  }
+
+  for (size_t i = 0; hook_names[i] != NULL; i++)
+    if (dlsym(dl_handle, hook_names[i]) == NULL)
+      all_hooks = false;
+
+  /* Leaving out the hooks means all hooks. */
+  if (!all_hooks) {
+    printf("hooks:");
+
+    for (size_t i = 0; hook_names[i] != NULL; i++)
+      if (dlsym(dl_handle, hook_names[i]) != NULL)
+        printf(" %s", hook_names[i]);
+
+    printf("\n");
+  }
+
+  (void) dlclose(dl_handle);
+
+  if (fflush(stdout) != 0) {
+    perror(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  return EXIT_SUCCESS;
+}
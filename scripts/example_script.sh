@@ -19,12 +19,19 @@ PRECEEDS="new all"
 DEPENDS="all"
 # CONFLICTS=""
 
+# The version of the hook protocol this script speaks.  Please see PLUGINS.
+PROTOCOL=1
+
 
 hooks() {
   # The name of the hook that should be executed is read as a string from
-  # stdin.  This function should only exit when stdin hits end-of-file.
+  # stdin together with a sequence number.  The result is acknowledged on
+  # stdout with the same number.  This function should only exit when stdin
+  # hits end-of-file.
+
+  while read sequence hook_name ; do
+    status="ok"
 
-  while read hook_name ; do
     case "${hook_name}" in
       vlock_start)
         # do something here that should happen at the start of vlock
@@ -38,13 +45,18 @@ hooks() {
       vlock_save_abort)
         # abort a screensaver type action here
       ;;
+      *)
+        status="failed"
+      ;;
     esac
+
+    echo "${sequence} ${status}"
   done
 }
 
 # Everything below is boilerplate code that shouldn't need to be changed.
 
-if [ $# -ne 1 ] ; then
+if [ $# -lt 1 ] ; then
   echo >&2 "Usage: $0 <command>"
   exit 1
 fi
@@ -53,6 +65,16 @@ case "$1" in
   hooks)
     hooks
   ;;
+  manifest)
+    echo "vlock-manifest 1"
+    echo "preceeds: ${PRECEEDS}"
+    echo "succeeds: ${SUCCEEDS}"
+    echo "requires: ${REQUIRES}"
+    echo "needs: ${NEEDS}"
+    echo "depends: ${DEPENDS}"
+    echo "conflicts: ${CONFLICTS}"
+    echo "protocol: ${PROTOCOL}"
+  ;;
   preceeds)
     echo "${PRECEEDS}"
   ;;
@@ -44,6 +44,15 @@ case "$1" in
   hooks)
     hooks
   ;;
+  manifest)
+    echo "vlock-manifest 1"
+    echo "preceeds: ${PRECEEDS}"
+    echo "succeeds: ${SUCCEEDS}"
+    echo "requires: ${REQUIRES}"
+    echo "needs: ${NEEDS}"
+    echo "depends: ${DEPENDS}"
+    echo "conflicts: ${CONFLICTS}"
+  ;;
   preceeds)
     echo "${PRECEEDS}"
   ;;
@@ -46,11 +46,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
 
 #include <security/pam_appl.h>
 
 #include "auth.h"
 #include "prompt.h"
+#include "secret.h"
 
 GQuark vlock_auth_error_quark(void)
 {
@@ -60,9 +62,62 @@ GQuark vlock_auth_error_quark(void)
 struct conversation_data
 {
   GError *error;
-  struct timespec *timeout;
+  const struct prompt_timeout *timeout;
+  /* If set this answers the password prompt instead of the user.  PAM may
+   * not ask for anything else then. */
+  const char *password;
+  bool password_used;
 };
 
+/* PAM frees the responses with free() so the password has to leave the secret
+ * memory.  It is copied at the last possible moment and the secret is given
+ * back right away. */
+static char *copy_response(char *secret, GError **error)
+{
+  char *response;
+
+  if (secret == NULL)
+    return NULL;
+
+  if ((response = strdup(secret)) == NULL)
+    g_propagate_error(error,
+                      g_error_new_literal(
+                        VLOCK_AUTH_ERROR,
+                        VLOCK_AUTH_ERROR_FAILED,
+                        g_strerror(errno)));
+
+  secret_free(secret);
+
+  return response;
+}
+
+/* Answer the password prompt with the given password.  This is only possible
+ * once. */
+static char *given_password(struct conversation_data *conv_data)
+{
+  char *response;
+
+  if (conv_data->password_used) {
+    g_set_error_literal(&conv_data->error,
+                        VLOCK_AUTH_ERROR,
+                        VLOCK_AUTH_ERROR_FAILED,
+                        "PAM asked for more than the password");
+    return NULL;
+  }
+
+  if ((response = strdup(conv_data->password)) == NULL) {
+    g_set_error_literal(&conv_data->error,
+                        VLOCK_AUTH_ERROR,
+                        VLOCK_AUTH_ERROR_FAILED,
+                        g_strerror(errno));
+    return NULL;
+  }
+
+  conv_data->password_used = true;
+
+  return response;
+}
+
 /* PAM conversation function.  Assumes that a pointer to struct
  * conversation_data is passed as the as appdata_ptr argument.  In case of a
  * normal error conversation_data's error field is set accordingly and
@@ -85,16 +140,36 @@ static int conversation(int num_msg, const struct pam_message **msg, struct
   for (int i = 0; i < num_msg; i++) {
     switch (msg[i]->msg_style) {
       case PAM_PROMPT_ECHO_OFF:
-        aresp[i].resp = prompt_echo_off(msg[i]->msg,
-                                        conv_data->timeout,
-                                        &conv_data->error);
+        if (conv_data->password != NULL) {
+          aresp[i].resp = given_password(conv_data);
+
+          if (aresp[i].resp == NULL)
+            goto fail;
+
+          break;
+        }
+
+        aresp[i].resp = copy_response(prompt_echo_off(msg[i]->msg,
+                                                      conv_data->timeout,
+                                                      &conv_data->error),
+                                      &conv_data->error);
         if (aresp[i].resp == NULL)
           goto fail;
         break;
       case PAM_PROMPT_ECHO_ON:
-        aresp[i].resp = prompt(msg[i]->msg,
-                               conv_data->timeout,
-                               &conv_data->error);
+        if (conv_data->password != NULL) {
+          g_set_error(&conv_data->error,
+                      VLOCK_AUTH_ERROR,
+                      VLOCK_AUTH_ERROR_FAILED,
+                      "PAM asked for more than the password: %s",
+                      msg[i]->msg);
+          goto fail;
+        }
+
+        aresp[i].resp = copy_response(prompt(msg[i]->msg,
+                                             conv_data->timeout,
+                                             &conv_data->error),
+                                      &conv_data->error);
         if (aresp[i].resp == NULL)
           goto fail;
         break;
@@ -118,12 +193,12 @@ static int conversation(int num_msg, const struct pam_message **msg, struct
 fail:
   for (int i = 0; i < num_msg; ++i) {
     if (aresp[i].resp != NULL) {
-      memset(aresp[i].resp, 0, strlen(aresp[i].resp));
+      secret_wipe(aresp[i].resp, strlen(aresp[i].resp));
       free(aresp[i].resp);
     }
   }
 
-  memset(aresp, 0, num_msg * sizeof *aresp);
+  secret_wipe(aresp, num_msg * sizeof *aresp);
   free(aresp);
   *resp = NULL;
 
@@ -132,19 +207,19 @@ fail:
   return PAM_CONV_ERR;
 }
 
-bool auth(const char *user, struct timespec *timeout, GError **error)
+/* Run the PAM authentication for the given user with the given conversation
+ * data. */
+static bool authenticate(const char *user,
+                         struct conversation_data *conv_data,
+                         GError **error)
 {
   char *pam_tty;
   pam_handle_t *pamh;
   int pam_status;
   int pam_end_status;
-  struct conversation_data conv_data = {
-    .error = NULL,
-    .timeout = timeout,
-  };
   struct pam_conv pamc = {
     .conv = conversation,
-    .appdata_ptr = &conv_data,
+    .appdata_ptr = conv_data,
   };
 
   g_return_val_if_fail(error == NULL || *error == NULL, false);
@@ -179,8 +254,10 @@ bool auth(const char *user, struct timespec *timeout, GError **error)
   }
 
   /* put the username before the password prompt */
-  fprintf(stderr, "%s's ", user);
-  fflush(stderr);
+  if (conv_data->password == NULL) {
+    fprintf(stderr, "%s's ", user);
+    fflush(stderr);
+  }
 
   /* authenticate the user */
   pam_status = pam_authenticate(pamh, 0);
@@ -189,8 +266,8 @@ bool auth(const char *user, struct timespec *timeout, GError **error)
 	     pam_status == PAM_AUTH_ERR ||
              pam_status == PAM_USER_UNKNOWN ||
              pam_status == PAM_MAXTRIES) {
-    if (conv_data.error != NULL) 
-      g_propagate_error(error, conv_data.error);
+    if (conv_data->error != NULL)
+      g_propagate_error(error, conv_data->error);
     else
       g_propagate_error(error,
 			g_error_new_literal(
@@ -198,7 +275,7 @@ bool auth(const char *user, struct timespec *timeout, GError **error)
 			  VLOCK_AUTH_ERROR_DENIED,
 			  "Authentication failure"));
   } else if (pam_status != PAM_SUCCESS) {
-    g_assert(conv_data.error == NULL);
+    g_assert(conv_data->error == NULL);
 
     g_propagate_error(error,
                       g_error_new_literal(
@@ -221,3 +298,28 @@ end:
   return (pam_end_status == PAM_SUCCESS && pam_status == PAM_SUCCESS);
 }
 
+bool auth(const char *user,
+          const struct prompt_timeout *timeout,
+          GError **error)
+{
+  struct conversation_data conv_data = {
+    .error = NULL,
+    .timeout = timeout,
+    .password = NULL,
+    .password_used = false,
+  };
+
+  return authenticate(user, &conv_data, error);
+}
+
+bool auth_password(const char *user, const char *password, GError **error)
+{
+  struct conversation_data conv_data = {
+    .error = NULL,
+    .timeout = NULL,
+    .password = password,
+    .password_used = false,
+  };
+
+  return authenticate(user, &conv_data, error);
+}
@@ -15,7 +15,7 @@
 #define _XOPEN_SOURCE
 
 #ifndef __FreeBSD__
-/* for asprintf() */
+/* for asprintf() and crypt_r() */
 #define _GNU_SOURCE
 #endif
 
@@ -30,63 +30,77 @@
 
 #include <shadow.h>
 
+#ifndef __FreeBSD__
+#include <crypt.h>
+#endif
+
 #include "auth.h"
 #include "prompt.h"
+#include "secret.h"
 
 GQuark vlock_auth_error_quark(void)
 {
   return g_quark_from_static_string("vlock-auth-shadow-error-quark");
 }
 
-bool auth(const char *user, struct timespec *timeout, GError **error)
+bool auth_password(const char *user, const char *password, GError **error)
 {
-  char *pwd;
   char *cryptpw;
-  char *msg;
+  struct spwd spwd;
   struct spwd *spw;
-  int result = false;
+  char buffer[4096];
+  struct crypt_data *crypt_data;
+  int status;
+  bool result = false;
 
   g_return_val_if_fail(error == NULL || *error == NULL, false);
 
-  /* format the prompt */
-  if (asprintf(&msg, "%s's Password: ", user) < 0) {
-    g_propagate_error(error,
-                      g_error_new_literal(
-                        VLOCK_AUTH_ERROR,
-                        VLOCK_AUTH_ERROR_FAILED,
-                        g_strerror(errno)));
-    return false;
-  }
-
-  if ((pwd = prompt_echo_off(msg, timeout, error)) == NULL)
-    goto prompt_error;
+  /* get the shadow password; this may run in a worker thread so only
+   * reentrant functions are used */
+  status = getspnam_r(user, &spwd, buffer, sizeof buffer, &spw);
 
-  errno = 0;
-
-  /* get the shadow password */
-  if ((spw = getspnam(user)) == NULL) {
-    if (errno == 0)
+  if (spw == NULL) {
+    if (status == 0 || status == ENOENT)
       goto auth_error;
 
     g_set_error(error,
                 VLOCK_AUTH_ERROR,
                 VLOCK_AUTH_ERROR_FAILED,
                 "Could not get shadow record: %s",
+                g_strerror(status));
+    goto shadow_error;
+  }
+
+  /* hash the password; the hash and the state of crypt_r() are derived from
+   * the password and thus kept in secret memory */
+  crypt_data = secret_map(sizeof *crypt_data);
+
+  if (crypt_data == NULL) {
+    g_set_error(error,
+                VLOCK_AUTH_ERROR,
+                VLOCK_AUTH_ERROR_FAILED,
+                "Could not allocate secret memory: %s",
                 g_strerror(errno));
     goto shadow_error;
   }
 
-  /* hash the password */
-  if ((cryptpw = crypt(pwd, spw->sp_pwdp)) == NULL) {
+  cryptpw = crypt_r(password, spw->sp_pwdp, crypt_data);
+
+  if (cryptpw == NULL) {
     g_set_error(error,
                 VLOCK_AUTH_ERROR,
                 VLOCK_AUTH_ERROR_FAILED,
                 "crypt() failed: %s",
                 g_strerror(errno));
-    goto shadow_error;
+  } else {
+    result = (strcmp(cryptpw, spw->sp_pwdp) == 0);
   }
 
-  result = (strcmp(cryptpw, spw->sp_pwdp) == 0);
+  /* wipe and unmap the hash */
+  secret_unmap(crypt_data, sizeof *crypt_data);
+
+  if (cryptpw == NULL)
+    goto shadow_error;
 
   if (!result) {
 auth_error:
@@ -99,18 +113,46 @@ auth_error:
   }
 
 shadow_error:
-  /* deallocate shadow resources */
-  endspent();
+  /* clear the shadow record */
+  secret_wipe(buffer, sizeof buffer);
+
+  g_assert(result || error == NULL || *error != NULL);
 
-  /* free the password */
-  free(pwd);
+  return result;
+}
+
+bool auth(const char *user,
+          const struct prompt_timeout *timeout,
+          GError **error)
+{
+  char *pwd;
+  char *msg;
+  bool result;
+
+  g_return_val_if_fail(error == NULL || *error == NULL, false);
+
+  /* format the prompt */
+  if (asprintf(&msg, "%s's Password: ", user) < 0) {
+    g_propagate_error(error,
+                      g_error_new_literal(
+                        VLOCK_AUTH_ERROR,
+                        VLOCK_AUTH_ERROR_FAILED,
+                        g_strerror(errno)));
+    return false;
+  }
+
+  pwd = prompt_echo_off(msg, timeout, error);
 
-prompt_error:
   /* free the prompt */
   free(msg);
 
-  g_assert(result || error != NULL);
+  if (pwd == NULL)
+    return false;
+
+  result = auth_password(user, pwd, error);
+
+  /* wipe and free the password */
+  secret_free(pwd);
 
   return result;
 }
-
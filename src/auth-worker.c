@@ -0,0 +1,270 @@
+/* auth-worker.c -- authentication in a worker thread for vlock,
+ *                  the VT locking program for linux
+ *
+ * This program is copyright (C) 2007 Frank Benkstein, and is free
+ * software which is freely distributable under the terms of the
+ * GNU General Public License version 2, included as the file COPYING in this
+ * distribution.  It is NOT public domain software, and any
+ * redistribution not permitted by the GNU General Public License is
+ * expressly forbidden without prior written permission from
+ * the author.
+ *
+ */
+
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#include <glib.h>
+
+#include "auth.h"
+#include "prompt.h"
+#include "loop.h"
+#include "secret.h"
+
+/* Several attempts may run at the same time:  auth_any() checks all users at
+ * once and a worker that is abandoned after a timeout is not stopped, so it
+ * may still be inside the PAM stack when the next attempt starts.  Each
+ * attempt uses its own PAM handle, which libpam supports, but the PAM modules
+ * in the stack are assumed to be thread-safe as well.  Refusing new attempts
+ * while an abandoned worker is alive is not an option because a module that
+ * hangs forever would then keep the console locked forever.  The shadow
+ * backend only uses reentrant functions. */
+
+/* An authentication attempt.  It is shared by the loop and the worker because
+ * an abandoned worker may outlive the call of auth_in_worker(). */
+struct attempt
+{
+  gint references;
+  gchar *user;
+  /* The password to check or NULL to prompt for it. */
+  char *password;
+  struct timespec inactivity;
+  struct prompt_timeout timeout;
+  bool result;
+  GError *error;
+};
+
+static void unref_attempt(struct attempt *attempt)
+{
+  if (g_atomic_int_dec_and_test(&attempt->references)) {
+    g_clear_error(&attempt->error);
+    g_free(attempt->user);
+    secret_free(attempt->password);
+    g_free(attempt);
+  }
+}
+
+static void run_attempt(void *data)
+{
+  struct attempt *attempt = data;
+
+  if (attempt->password != NULL)
+    attempt->result = auth_password(attempt->user,
+                                    attempt->password,
+                                    &attempt->error);
+  else
+    attempt->result = auth(attempt->user, &attempt->timeout, &attempt->error);
+
+  unref_attempt(attempt);
+}
+
+/* Create an attempt that is referenced by the caller and the worker. */
+static struct attempt *new_attempt(const char *user,
+                                   const char *password,
+                                   const struct prompt_timeout *timeout)
+{
+  struct attempt *attempt = g_new0(struct attempt, 1);
+
+  attempt->references = 2;
+  attempt->user = g_strdup(user);
+
+  /* The worker gets its own copy because it may outlive the caller's. */
+  if (password != NULL) {
+    size_t length = strlen(password) + 1;
+
+    attempt->password = secret_alloc(length);
+
+    if (attempt->password != NULL)
+      memcpy(attempt->password, password, length);
+  }
+
+  if (timeout != NULL) {
+    attempt->timeout = *timeout;
+
+    if (timeout->inactivity != NULL) {
+      attempt->inactivity = *timeout->inactivity;
+      attempt->timeout.inactivity = &attempt->inactivity;
+    }
+  }
+
+  return attempt;
+}
+
+/* Get the time that is left until the deadline of the timeout.  Returns NULL
+ * if there is no deadline. */
+static const struct timespec *time_left(const struct prompt_timeout *timeout,
+                                        struct timespec *left)
+{
+  gint64 usec;
+
+  if (timeout == NULL || timeout->deadline == 0)
+    return NULL;
+
+  usec = MAX(timeout->deadline - g_get_monotonic_time(), 0);
+  left->tv_sec = (time_t) (usec / G_USEC_PER_SEC);
+  left->tv_nsec = (long) (usec % G_USEC_PER_SEC) * 1000;
+
+  return left;
+}
+
+static void set_timeout_error(GError **error)
+{
+  g_propagate_error(error,
+                    g_error_new_literal(
+                      VLOCK_PROMPT_ERROR,
+                      VLOCK_PROMPT_ERROR_TIMEOUT,
+                      ""));
+}
+
+bool auth_in_worker(const char *user,
+                    const struct prompt_timeout *timeout,
+                    GError **error)
+{
+  struct attempt *attempt;
+  struct loop_worker *worker;
+  struct timespec left;
+  bool result = false;
+
+  g_return_val_if_fail(error == NULL || *error == NULL, false);
+
+  attempt = new_attempt(user, NULL, timeout);
+  worker = loop_worker_new(run_attempt, attempt, NULL);
+
+  /* Without a thread authenticate in this one. */
+  if (worker == NULL) {
+    attempt->references = 1;
+    unref_attempt(attempt);
+    return auth(user, timeout, error);
+  }
+
+  if (loop_worker_wait(worker, time_left(timeout, &left))) {
+    result = attempt->result;
+
+    if (attempt->error != NULL) {
+      g_propagate_error(error, attempt->error);
+      attempt->error = NULL;
+    }
+  } else {
+    g_debug("abandoning the authentication of %s", user);
+    set_timeout_error(error);
+  }
+
+  loop_worker_free(worker);
+  unref_attempt(attempt);
+
+  g_assert(result || error == NULL || *error != NULL);
+
+  return result;
+}
+
+bool auth_any(const char *const users[],
+              const char *password,
+              const struct prompt_timeout *timeout,
+              GError **error)
+{
+  size_t nr_users = g_strv_length((gchar **) users);
+  struct attempt **attempts = g_new(struct attempt *, nr_users);
+  bool *finished = g_new0(bool, nr_users);
+  /* The workers that are still running and the users they belong to. */
+  struct loop_worker **running = g_new(struct loop_worker *, nr_users);
+  size_t *running_user = g_new(size_t, nr_users);
+  size_t nr_running = 0;
+  struct timespec left;
+  bool result = false;
+  bool timed_out = false;
+
+  g_return_val_if_fail(error == NULL || *error == NULL, false);
+
+  for (size_t i = 0; i < nr_users; i++) {
+    struct loop_worker *worker;
+
+    attempts[i] = new_attempt(users[i], password, timeout);
+
+    if (attempts[i]->password == NULL) {
+      g_set_error_literal(&attempts[i]->error,
+                          VLOCK_AUTH_ERROR,
+                          VLOCK_AUTH_ERROR_FAILED,
+                          g_strerror(errno));
+      attempts[i]->references = 1;
+      finished[i] = true;
+      continue;
+    }
+
+    worker = loop_worker_new(run_attempt, attempts[i], NULL);
+
+    if (worker == NULL) {
+      /* Check this one in this thread. */
+      run_attempt(attempts[i]);
+      finished[i] = true;
+      result = result || attempts[i]->result;
+    } else {
+      running[nr_running] = worker;
+      running_user[nr_running] = i;
+      nr_running++;
+    }
+  }
+
+  /* The first success wins. */
+  while (!result && nr_running > 0) {
+    size_t k = loop_worker_wait_any(running,
+                                    nr_running,
+                                    time_left(timeout, &left));
+    size_t i;
+
+    if (k == nr_running) {
+      timed_out = true;
+      break;
+    }
+
+    i = running_user[k];
+    finished[i] = true;
+    result = attempts[i]->result;
+
+    loop_worker_free(running[k]);
+    nr_running--;
+    running[k] = running[nr_running];
+    running_user[k] = running_user[nr_running];
+  }
+
+  /* The remaining checks are abandoned. */
+  for (size_t k = 0; k < nr_running; k++)
+    loop_worker_free(running[k]);
+
+  if (!result) {
+    if (timed_out) {
+      set_timeout_error(error);
+    } else {
+      for (size_t i = 0; i < nr_users; i++) {
+        if (finished[i] && attempts[i]->error != NULL) {
+          g_propagate_error(error, attempts[i]->error);
+          attempts[i]->error = NULL;
+          break;
+        }
+      }
+    }
+  }
+
+  for (size_t i = 0; i < nr_users; i++)
+    unref_attempt(attempts[i]);
+
+  g_free(running_user);
+  g_free(running);
+  g_free(finished);
+  g_free(attempts);
+
+  g_assert(result || error == NULL || *error != NULL);
+
+  return result;
+}
@@ -15,7 +15,7 @@
 #include <glib.h>
 
 /* forward declaration */
-struct timespec;
+struct prompt_timeout;
 
 #define VLOCK_AUTH_ERROR vlock_auth_error_quark()
 GQuark vlock_auth_error_quark(void);
@@ -30,4 +30,32 @@ enum {
  * reason the function returns false.  The timeout is passed to the prompt
  * functions below if they are called.
  */
-bool auth(const char *user, struct timespec *timeout, GError **error);
+bool auth(const char *user,
+          const struct prompt_timeout *timeout,
+          GError **error);
+
+/* Check the given password of the user without prompting.  Fails with
+ * VLOCK_AUTH_ERROR_FAILED if the authentication needs more than the password.
+ * Safe to call from any thread. */
+bool auth_password(const char *user, const char *password, GError **error);
+
+/* Same as auth() except that the authentication runs in a worker thread while
+ * the event loop keeps running, so a slow password hash or PAM module does
+ * not stall signals, timers and plugins.  Prompts are still shown by the
+ * calling thread.  If the timeout has a deadline and the authentication did
+ * not finish by then it is abandoned and fails with
+ * VLOCK_PROMPT_ERROR_TIMEOUT.  An abandoned worker keeps running, so the
+ * authentication of a later call may run at the same time. */
+bool auth_in_worker(const char *user,
+                    const struct prompt_timeout *timeout,
+                    GError **error);
+
+/* Check the given password against all of the given users at the same time,
+ * each in a worker thread.  The users are given as a NULL terminated array.
+ * Returns true as soon as one of the checks succeeded.  If all fail the error
+ * of the first user is returned.  The deadline of the timeout is handled like
+ * in auth_in_worker(). */
+bool auth_any(const char *const users[],
+              const char *password,
+              const struct prompt_timeout *timeout,
+              GError **error);
@@ -0,0 +1,294 @@
+/* cache.c -- dependency cache for vlock, the VT locking program for linux
+ *
+ * This program is copyright (C) 2007 Frank Benkstein, and is free
+ * software which is freely distributable under the terms of the
+ * GNU General Public License version 2, included as the file COPYING in this
+ * distribution.  It is NOT public domain software, and any
+ * redistribution not permitted by the GNU General Public License is
+ * expressly forbidden without prior written permission from
+ * the author.
+ *
+ */
+
+/* Getting the dependencies of a script means starting it at least once.
+ * Because the dependencies rarely change they are stored in a cache directory
+ * with one file per script.  Each file starts with the identity of the script
+ * it was written for, followed by a checksum and the dependencies in manifest
+ * format:
+ *
+ *   path /usr/local/lib/vlock/scripts/example
+ *   device 2049
+ *   inode 1234
+ *   size 2345
+ *   mtime 1199142000.000000000
+ *   ctime 1199142000.000000000
+ *   checksum <sha256 of everything except this line>
+ *   vlock-manifest 1
+ *   depends: all
+ *
+ * The checksum is not keyed.  It only detects entries that were truncated or
+ * otherwise corrupted, not entries that were forged, so the cache directory
+ * and its files must only be writable by root.  Entries that do not match the
+ * script or fail any of the checks are ignored and overwritten after the
+ * script was probed.
+ */
+
+#if !defined(__FreeBSD__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+
+#include "plugin.h"
+#include "cache.h"
+
+/* Cache entries larger than this are never written and thus invalid. */
+#define CACHE_ENTRY_MAX (64 * 1024)
+
+#define CHECKSUM_PREFIX "checksum "
+
+/* Get the identity of the given file as it is written to the cache. */
+static gchar *get_identity(const char *path, const struct stat *st)
+{
+  return g_strdup_printf("path %s\n"
+                         "device %lu\n"
+                         "inode %lu\n"
+                         "size %lld\n"
+                         "mtime %lld.%09ld\n"
+                         "ctime %lld.%09ld\n",
+                         path,
+                         (unsigned long) st->st_dev,
+                         (unsigned long) st->st_ino,
+                         (long long) st->st_size,
+                         (long long) st->st_mtim.tv_sec,
+                         (long) st->st_mtim.tv_nsec,
+                         (long long) st->st_ctim.tv_sec,
+                         (long) st->st_ctim.tv_nsec);
+}
+
+/* Get the checksum of the identity and the manifest. */
+static gchar *get_checksum(const char *identity, const char *manifest)
+{
+  GChecksum *checksum = g_checksum_new(G_CHECKSUM_SHA256);
+  gchar *result;
+
+  g_checksum_update(checksum, (const guchar *) identity, -1);
+  g_checksum_update(checksum, (const guchar *) manifest, -1);
+
+  result = g_strdup(g_checksum_get_string(checksum));
+
+  g_checksum_free(checksum);
+
+  return result;
+}
+
+/* Check that the given file is owned by root and not writable by anybody
+ * else. */
+static bool is_trusted(const struct stat *st)
+{
+  return st->st_uid == 0 && (st->st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
+
+/* Get the path of the cache file for the named plugin or NULL if the name
+ * cannot be used as a file name. */
+static gchar *get_cache_path(const char *name)
+{
+  if (*name == '\0' || *name == '.' || strchr(name, '/') != NULL)
+    return NULL;
+
+  return g_strdup_printf("%s/%s", VLOCK_CACHE_DIR, name);
+}
+
+/* Read the whole cache file.  Fails if the file or the cache directory are
+ * not trusted. */
+static gchar *read_cache_file(const char *cache_path)
+{
+  struct stat st;
+  gchar *data;
+  ssize_t length;
+  int fd;
+
+  if (stat(VLOCK_CACHE_DIR, &st) < 0 || !S_ISDIR(st.st_mode) ||
+      !is_trusted(&st))
+    return NULL;
+
+  fd = open(cache_path, O_RDONLY | O_NOFOLLOW);
+
+  if (fd < 0)
+    return NULL;
+
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || !is_trusted(&st) ||
+      st.st_size >= CACHE_ENTRY_MAX) {
+    (void) close(fd);
+    return NULL;
+  }
+
+  data = g_malloc(st.st_size + 1);
+  length = read(fd, data, st.st_size);
+
+  (void) close(fd);
+
+  if (length != st.st_size) {
+    g_free(data);
+    return NULL;
+  }
+
+  data[length] = '\0';
+
+  return data;
+}
+
+bool cache_lookup_dependencies(VlockPlugin *plugin,
+                               const char *path,
+                               const struct stat *st)
+{
+  gchar *cache_path = get_cache_path(plugin->name);
+  gchar *data = NULL;
+  gchar *identity = NULL;
+  gchar *checksum = NULL;
+  char *checksum_line;
+  char *manifest;
+  size_t identity_length;
+  bool result = false;
+
+  if (cache_path == NULL)
+    return false;
+
+  data = read_cache_file(cache_path);
+
+  if (data == NULL)
+    goto out;
+
+  identity = get_identity(path, st);
+  identity_length = strlen(identity);
+
+  /* Is this entry stale? */
+  if (strncmp(data, identity, identity_length) != 0)
+    goto out;
+
+  checksum_line = data + identity_length;
+
+  if (!g_str_has_prefix(checksum_line, CHECKSUM_PREFIX))
+    goto out;
+
+  manifest = strchr(checksum_line, '\n');
+
+  if (manifest == NULL)
+    goto out;
+
+  /* Terminate the checksum line. */
+  *manifest++ = '\0';
+
+  /* Has this entry been corrupted? */
+  checksum = get_checksum(identity, manifest);
+
+  if (strcmp(checksum_line + strlen(CHECKSUM_PREFIX), checksum) != 0) {
+    g_debug("cache entry for '%s' has a wrong checksum", plugin->name);
+    goto out;
+  }
+
+  result = vlock_plugin_parse_manifest(plugin, manifest, NULL);
+
+  /* The script is probed instead.  Forget what was parsed up to the error so
+   * that nothing is declared twice. */
+  if (!result) {
+    for (size_t i = 0; i < nr_dependencies; i++) {
+      g_list_free(plugin->dependencies[i]);
+      plugin->dependencies[i] = NULL;
+    }
+
+    for (size_t i = 0; i < nr_hooks; i++)
+      plugin->has_hook[i] = true;
+
+    plugin->protocol = 0;
+  }
+
+out:
+  g_free(checksum);
+  g_free(identity);
+  g_free(data);
+  g_free(cache_path);
+
+  return result;
+}
+
+void cache_store_dependencies(VlockPlugin *plugin,
+                              const char *path,
+                              const struct stat *st)
+{
+  gchar *cache_path;
+  gchar *tmp_path;
+  gchar *identity;
+  gchar *manifest;
+  gchar *checksum;
+  gchar *data;
+  size_t length;
+  bool written;
+  int fd;
+
+  /* Only root may write to the cache.  The effective user ID is always root
+   * because vlock-main is installed setuid, but the probes run with the
+   * environment of whoever started it, who could make a script print
+   * arbitrary dependencies.  Their results are only kept if the real user is
+   * root as well. */
+  if (getuid() != 0)
+    return;
+
+  cache_path = get_cache_path(plugin->name);
+
+  if (cache_path == NULL)
+    return;
+
+  /* The directory may not exist yet. */
+  if (mkdir(VLOCK_CACHE_DIR, 0755) < 0 && errno != EEXIST)
+    goto mkdir_failed;
+
+  identity = get_identity(path, st);
+  manifest = vlock_plugin_format_manifest(plugin);
+  checksum = get_checksum(identity, manifest);
+  data = g_strdup_printf("%s" CHECKSUM_PREFIX "%s\n%s",
+                         identity,
+                         checksum,
+                         manifest);
+  length = strlen(data);
+
+  /* Write to a temporary file and rename it afterwards so that readers never
+   * see partial entries. */
+  tmp_path = g_strdup_printf("%s/.%s.XXXXXX", VLOCK_CACHE_DIR, plugin->name);
+  fd = mkstemp(tmp_path);
+
+  if (fd < 0)
+    goto mkstemp_failed;
+
+  written = (fchmod(fd, 0644) == 0 &&
+             write(fd, data, length) == (ssize_t) length);
+
+  if (close(fd) < 0)
+    written = false;
+
+  if (!written || rename(tmp_path, cache_path) < 0) {
+    g_debug("could not write cache entry for '%s': %s",
+            plugin->name,
+            g_strerror(errno));
+    (void) unlink(tmp_path);
+  }
+
+mkstemp_failed:
+  g_free(tmp_path);
+  g_free(data);
+  g_free(checksum);
+  g_free(manifest);
+  g_free(identity);
+
+mkdir_failed:
+  g_free(cache_path);
+}
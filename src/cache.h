@@ -0,0 +1,34 @@
+/* cache.h -- header file for the dependency cache of vlock,
+ *            the VT locking program for linux
+ *
+ * This program is copyright (C) 2007 Frank Benkstein, and is free
+ * software which is freely distributable under the terms of the
+ * GNU General Public License version 2, included as the file COPYING in this
+ * distribution.  It is NOT public domain software, and any
+ * redistribution not permitted by the GNU General Public License is
+ * expressly forbidden without prior written permission from
+ * the author.
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "plugin.h"
+
+/* Fill the dependencies of the given plugin from the cache.  The entry is only
+ * used if it was written for a file with the same path, device, inode, size,
+ * modification and change time as given in the stat buffer, if its checksum is
+ * correct and if it is only writable by root.  Returns true on a cache hit. */
+bool cache_lookup_dependencies(VlockPlugin *plugin,
+                               const char *path,
+                               const struct stat *st);
+
+/* Store the dependencies of the given plugin in the cache.  Nothing is stored
+ * unless vlock was started by root.  Errors are silently ignored. */
+void cache_store_dependencies(VlockPlugin *plugin,
+                              const char *path,
+                              const struct stat *st);
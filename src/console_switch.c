@@ -31,12 +31,13 @@
 #endif
 
 #include "console_switch.h"
+#include "loop.h"
 
 /* Is console switching currently disabled? */
 bool console_switch_locked = false;
 
-/* This handler is called whenever a user tries to
- * switch away from this virtual console. */
+/* The handlers below are called from the event loop.  This one is called
+ * whenever a user tries to switch away from this virtual console. */
 static void release_vt(int __attribute__ ((__unused__)) signum)
 {
   /* Deny console switch. */
@@ -53,9 +54,6 @@ static void acquire_vt(int __attribute__ ((__unused__)) signum)
 
 /* Console mode before switching was disabled. */
 static struct vt_mode vtm;
-/* Signal actions before console handling was disabled. */
-static struct sigaction sa_usr1;
-static struct sigaction sa_usr2;
 
 /* Disable virtual console switching in the kernel.  If disabling fails false
  * is returned and errno is set. */
@@ -63,7 +61,6 @@ bool lock_console_switch(void)
 {
   /* Console mode when switching is disabled. */
   struct vt_mode lock_vtm;
-  struct sigaction sa;
 
   /* Get the virtual console mode. */
   if (ioctl(STDIN_FILENO, VT_GETMODE, &vtm) < 0) {
@@ -79,12 +76,8 @@ bool lock_console_switch(void)
   /* Copy the current virtual console mode. */
   lock_vtm = vtm;
 
-  (void) sigemptyset(&(sa.sa_mask));
-  sa.sa_flags = SA_RESTART;
-  sa.sa_handler = release_vt;
-  (void) sigaction(SIGUSR1, &sa, &sa_usr1);
-  sa.sa_handler = acquire_vt;
-  (void) sigaction(SIGUSR2, &sa, &sa_usr2);
+  loop_handle_signal(SIGUSR1, release_vt);
+  loop_handle_signal(SIGUSR2, acquire_vt);
 
   /* Set terminal switching to be process governed. */
   lock_vtm.mode = VT_PROCESS;
@@ -102,8 +95,8 @@ bool lock_console_switch(void)
     perror("vlock: disabling console switching failed");
 
     /* Reset signal handlers. */
-    (void) sigaction(SIGUSR1, &sa_usr1, NULL);
-    (void) sigaction(SIGUSR2, &sa_usr2, NULL);
+    loop_handle_signal(SIGUSR1, NULL);
+    loop_handle_signal(SIGUSR2, NULL);
     errno = 0;
     return false;
   }
@@ -117,8 +110,8 @@ bool unlock_console_switch(void)
 {
   if (ioctl(STDIN_FILENO, VT_SETMODE, &vtm) == 0) {
     /* Reset signal handlers. */
-    (void) sigaction(SIGUSR1, &sa_usr1, NULL);
-    (void) sigaction(SIGUSR2, &sa_usr2, NULL);
+    loop_handle_signal(SIGUSR1, NULL);
+    loop_handle_signal(SIGUSR2, NULL);
 
     return true;
   } else {
@@ -0,0 +1,492 @@
+/* loop.c -- event loop for vlock, the VT locking program for linux
+ *
+ * This program is copyright (C) 2007 Frank Benkstein, and is free
+ * software which is freely distributable under the terms of the
+ * GNU General Public License version 2, included as the file COPYING in this
+ * distribution.  It is NOT public domain software, and any
+ * redistribution not permitted by the GNU General Public License is
+ * expressly forbidden without prior written permission from
+ * the author.
+ *
+ */
+
+/* Everything vlock waits for goes through the default GLib main context:
+ * input from the terminal, the output of scripts, dying children, timers and
+ * signals.  Signals that have a handler are blocked after loop_init() and
+ * read from a signal file descriptor, so their handlers are ordinary
+ * functions that may do anything.  Timers use timer file descriptors.  Where
+ * either is not available signals interrupt the program like before and
+ * timers fall back to GLib's timeouts. */
+
+#if !defined(__FreeBSD__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#endif
+
+#include <glib.h>
+#include <glib-unix.h>
+
+#include "loop.h"
+
+/* The signals that are delivered through the loop. */
+static const int loop_signals[] = {
+  SIGHUP, SIGINT, SIGQUIT, SIGTERM, SIGUSR1, SIGUSR2,
+};
+
+#define nr_loop_signals (sizeof loop_signals / sizeof loop_signals[0])
+
+/* The handlers by signal number. */
+static void (*signal_handlers[NSIG])(int signum);
+
+/* The signal file descriptor or -1 if signals interrupt the program. */
+static int signal_fd = -1;
+
+/* Call the handler of a signal. */
+static void deliver_signal(int signum)
+{
+  void (*handler)(int signum) = signal_handlers[signum];
+
+  if (handler != NULL)
+    handler(signum);
+}
+
+void loop_handle_signal(int signum, void (*handler)(int signum))
+{
+  struct sigaction sa;
+
+  g_return_if_fail(signum > 0 && signum < NSIG);
+
+  signal_handlers[signum] = handler;
+
+  /* Ignored signals are not queued on the signal file descriptor either. */
+  (void) sigemptyset(&sa.sa_mask);
+  sa.sa_flags = SA_RESTART;
+  sa.sa_handler = (handler != NULL) ? deliver_signal : SIG_IGN;
+  (void) sigaction(signum, &sa, NULL);
+}
+
+/* A file descriptor watch. */
+struct watch
+{
+  bool (*callback)(int fd, void *data);
+  void *data;
+};
+
+static gboolean dispatch_watch(gint fd,
+                               GIOCondition __attribute__((unused)) condition,
+                               gpointer user_data)
+{
+  struct watch *watch = user_data;
+
+  return watch->callback(fd, watch->data) ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+guint loop_watch_fd(int fd, bool (*callback)(int fd, void *data), void *data)
+{
+  struct watch *watch = g_new(struct watch, 1);
+
+  watch->callback = callback;
+  watch->data = data;
+
+  return g_unix_fd_add_full(G_PRIORITY_DEFAULT, fd,
+                            G_IO_IN | G_IO_HUP | G_IO_ERR,
+                            dispatch_watch, watch, g_free);
+}
+
+void loop_remove(guint id)
+{
+  (void) g_source_remove(id);
+}
+
+void loop_run(const bool *done)
+{
+  while (!*done)
+    (void) g_main_context_iteration(NULL, true);
+}
+
+#ifdef __linux__
+/* Read all pending signals and call their handlers. */
+static bool dispatch_signals(int fd, void __attribute__((unused)) *data)
+{
+  struct signalfd_siginfo info;
+
+  while (read(fd, &info, sizeof info) == sizeof info)
+    if (info.ssi_signo < NSIG)
+      deliver_signal((int) info.ssi_signo);
+
+  return true;
+}
+#endif
+
+void loop_init(void)
+{
+#ifdef __linux__
+  sigset_t mask;
+
+  if (signal_fd >= 0)
+    return;
+
+  (void) sigemptyset(&mask);
+
+  for (size_t i = 0; i < nr_loop_signals; i++)
+    (void) sigaddset(&mask, loop_signals[i]);
+
+  if (pthread_sigmask(SIG_BLOCK, &mask, NULL) != 0)
+    return;
+
+  signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+
+  if (signal_fd < 0) {
+    (void) pthread_sigmask(SIG_UNBLOCK, &mask, NULL);
+    return;
+  }
+
+  (void) loop_watch_fd(signal_fd, dispatch_signals, NULL);
+#endif
+}
+
+struct loop_timer
+{
+  void (*callback)(void *data);
+  void *data;
+  /* The timer file descriptor or -1. */
+  int fd;
+  /* The watch of the descriptor or the GLib timeout, if any. */
+  guint source;
+};
+
+#ifdef __linux__
+static bool timer_expired(int fd, void *data)
+{
+  struct loop_timer *timer = data;
+  uint64_t expirations;
+
+  /* The timer may have been rearmed after it expired. */
+  if (read(fd, &expirations, sizeof expirations) == sizeof expirations)
+    timer->callback(timer->data);
+
+  return true;
+}
+#endif
+
+static gboolean timeout_expired(gpointer data)
+{
+  struct loop_timer *timer = data;
+
+  timer->source = 0;
+  timer->callback(timer->data);
+
+  return G_SOURCE_REMOVE;
+}
+
+struct loop_timer *loop_timer_new(void (*callback)(void *data), void *data)
+{
+  struct loop_timer *timer = g_new(struct loop_timer, 1);
+
+  timer->callback = callback;
+  timer->data = data;
+  timer->fd = -1;
+  timer->source = 0;
+
+#ifdef __linux__
+  timer->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+  if (timer->fd >= 0)
+    timer->source = loop_watch_fd(timer->fd, timer_expired, timer);
+#endif
+
+  return timer;
+}
+
+void loop_timer_free(struct loop_timer *timer)
+{
+  if (timer->source != 0)
+    loop_remove(timer->source);
+
+  if (timer->fd >= 0)
+    (void) close(timer->fd);
+
+  g_free(timer);
+}
+
+void loop_timer_start(struct loop_timer *timer, const struct timespec *timeout)
+{
+  gint64 milliseconds;
+
+#ifdef __linux__
+  if (timer->fd >= 0) {
+    struct itimerspec value = {
+      .it_interval = { 0, 0 },
+      .it_value = *timeout,
+    };
+
+    /* A zero value would disarm the timer. */
+    if (value.it_value.tv_sec == 0 && value.it_value.tv_nsec == 0)
+      value.it_value.tv_nsec = 1;
+
+    (void) timerfd_settime(timer->fd, 0, &value, NULL);
+    return;
+  }
+#endif
+
+  loop_timer_stop(timer);
+
+  /* Round up to whole milliseconds. */
+  milliseconds = (gint64) timeout->tv_sec * 1000 +
+                 (timeout->tv_nsec + 999999) / 1000000;
+
+  timer->source = g_timeout_add_full(G_PRIORITY_DEFAULT,
+                                     (guint) MIN(milliseconds, G_MAXUINT),
+                                     timeout_expired, timer, NULL);
+}
+
+void loop_timer_stop(struct loop_timer *timer)
+{
+#ifdef __linux__
+  if (timer->fd >= 0) {
+    struct itimerspec value = { { 0, 0 }, { 0, 0 } };
+    uint64_t expirations;
+
+    (void) timerfd_settime(timer->fd, 0, &value, NULL);
+    /* Forget an expiration that was not dispatched yet. */
+    (void) read(timer->fd, &expirations, sizeof expirations);
+    return;
+  }
+#endif
+
+  if (timer->source != 0) {
+    loop_remove(timer->source);
+    timer->source = 0;
+  }
+}
+
+struct loop_worker
+{
+  void (*function)(void *data);
+  void *data;
+  /* Dropped by the loop when the worker finished and by
+   * loop_worker_free(). */
+  gint references;
+  /* Set by loop_worker_free(). */
+  bool cancelled;
+  /* Set from the loop when the function returned. */
+  bool finished;
+  /* Protect the calls of the worker. */
+  GMutex lock;
+  GCond called;
+};
+
+/* Set from the loop when a worker finished or waiting for workers timed
+ * out. */
+static bool worker_event;
+
+/* The worker of the current thread, if any. */
+static GPrivate current_worker = G_PRIVATE_INIT(NULL);
+
+/* Call the function from the loop.  Unlike g_main_context_invoke() this never
+ * calls it in the current thread. */
+static void invoke(GSourceFunc function, gpointer data)
+{
+  GSource *source = g_idle_source_new();
+
+  g_source_set_callback(source, function, data, NULL);
+  (void) g_source_attach(source, NULL);
+  g_source_unref(source);
+}
+
+static void unref_worker(struct loop_worker *worker)
+{
+  if (g_atomic_int_dec_and_test(&worker->references)) {
+    g_mutex_clear(&worker->lock);
+    g_cond_clear(&worker->called);
+    g_free(worker);
+  }
+}
+
+static gboolean worker_finished(gpointer data)
+{
+  struct loop_worker *worker = data;
+
+  worker->finished = true;
+  worker_event = true;
+  unref_worker(worker);
+
+  return G_SOURCE_REMOVE;
+}
+
+static gpointer run_worker(gpointer data)
+{
+  struct loop_worker *worker = data;
+
+  g_private_set(&current_worker, worker);
+  worker->function(worker->data);
+  invoke(worker_finished, worker);
+
+  return NULL;
+}
+
+struct loop_worker *loop_worker_new(void (*function)(void *data),
+                                    void *data,
+                                    GError **error)
+{
+  struct loop_worker *worker = g_new(struct loop_worker, 1);
+  GThread *thread;
+
+  worker->function = function;
+  worker->data = data;
+  worker->references = 2;
+  worker->cancelled = false;
+  worker->finished = false;
+  g_mutex_init(&worker->lock);
+  g_cond_init(&worker->called);
+
+  thread = g_thread_try_new("worker", run_worker, worker, error);
+
+  if (thread == NULL) {
+    worker->references = 1;
+    unref_worker(worker);
+    return NULL;
+  }
+
+  g_thread_unref(thread);
+
+  return worker;
+}
+
+static void worker_timeout(void *data)
+{
+  bool *timed_out = data;
+
+  *timed_out = true;
+  worker_event = true;
+}
+
+size_t loop_worker_wait_any(struct loop_worker *const workers[],
+                            size_t nr_workers,
+                            const struct timespec *timeout)
+{
+  struct loop_timer *timer = NULL;
+  bool timed_out = false;
+  size_t i;
+
+  if (timeout != NULL) {
+    timer = loop_timer_new(worker_timeout, &timed_out);
+    loop_timer_start(timer, timeout);
+  }
+
+  for (;;) {
+    for (i = 0; i < nr_workers; i++)
+      if (workers[i]->finished)
+        goto out;
+
+    if (timed_out)
+      break;
+
+    worker_event = false;
+    loop_run(&worker_event);
+  }
+
+out:
+  if (timer != NULL)
+    loop_timer_free(timer);
+
+  /* This may have been called from a callback while another call waits for
+   * other workers.  Let that one check its workers again. */
+  worker_event = true;
+
+  return i;
+}
+
+bool loop_worker_wait(struct loop_worker *worker,
+                      const struct timespec *timeout)
+{
+  return loop_worker_wait_any(&worker, 1, timeout) == 0;
+}
+
+void loop_worker_free(struct loop_worker *worker)
+{
+  g_mutex_lock(&worker->lock);
+  worker->cancelled = true;
+  g_mutex_unlock(&worker->lock);
+
+  unref_worker(worker);
+}
+
+/* A call of a function on the loop thread. */
+struct loop_call
+{
+  struct loop_worker *worker;
+  void (*function)(void *data);
+  void *data;
+  /* Set when the function returned.  It is not called if the worker was
+   * cancelled. */
+  bool returned;
+  /* Set when the call was handled by the loop either way. */
+  bool completed;
+};
+
+static gboolean run_call(gpointer data)
+{
+  struct loop_call *call = data;
+  struct loop_worker *worker = call->worker;
+  /* Workers are only cancelled from the loop thread. */
+  bool cancelled = worker->cancelled;
+
+  if (!cancelled)
+    call->function(call->data);
+
+  g_mutex_lock(&worker->lock);
+  call->returned = !cancelled;
+  call->completed = true;
+  g_cond_broadcast(&worker->called);
+  g_mutex_unlock(&worker->lock);
+
+  return G_SOURCE_REMOVE;
+}
+
+bool loop_call(void (*function)(void *data), void *data)
+{
+  struct loop_worker *worker = g_private_get(&current_worker);
+  struct loop_call call = {
+    .worker = worker,
+    .function = function,
+    .data = data,
+    .returned = false,
+    .completed = false,
+  };
+  bool returned;
+
+  if (worker == NULL) {
+    function(data);
+    return true;
+  }
+
+  g_mutex_lock(&worker->lock);
+
+  /* Even if the worker is cancelled meanwhile the loop still refers to the
+   * call until it completed. */
+  if (!worker->cancelled) {
+    invoke(run_call, &call);
+
+    while (!call.completed)
+      g_cond_wait(&worker->called, &worker->lock);
+  }
+
+  returned = call.returned;
+  g_mutex_unlock(&worker->lock);
+
+  return returned;
+}
@@ -0,0 +1,84 @@
+/* loop.h -- header for the event loop of vlock,
+ *           the VT locking program for linux
+ *
+ * This program is copyright (C) 2007 Frank Benkstein, and is free
+ * software which is freely distributable under the terms of the
+ * GNU General Public License version 2, included as the file COPYING in this
+ * distribution.  It is NOT public domain software, and any
+ * redistribution not permitted by the GNU General Public License is
+ * expressly forbidden without prior written permission from
+ * the author.
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <time.h>
+#include <glib.h>
+
+/* Start delivering the signals vlock handles through the loop.  They are
+ * blocked in the calling thread so this must be called before any other
+ * threads are created. */
+void loop_init(void);
+
+/* Call the given handler when the signal arrives.  Once the loop is started
+ * the handler runs from the loop instead of interrupting the program.  If the
+ * handler is NULL the signal is ignored.  May be called from any thread. */
+void loop_handle_signal(int signum, void (*handler)(int signum));
+
+/* Call the given function whenever the file descriptor becomes readable or is
+ * closed by the other end.  The watch is removed if the function returns
+ * false.  Returns an id for loop_remove(). */
+guint loop_watch_fd(int fd, bool (*callback)(int fd, void *data), void *data);
+
+/* Remove the watch with the given id. */
+void loop_remove(guint id);
+
+/* Run the loop until the flag is set by one of the callbacks. */
+void loop_run(const bool *done);
+
+/* A timer that calls a function from the loop. */
+struct loop_timer;
+
+struct loop_timer *loop_timer_new(void (*callback)(void *data), void *data);
+void loop_timer_free(struct loop_timer *timer);
+
+/* Arm the timer to fire once after the given time.  A timer that is already
+ * armed is rearmed. */
+void loop_timer_start(struct loop_timer *timer, const struct timespec *timeout);
+
+/* Disarm the timer. */
+void loop_timer_stop(struct loop_timer *timer);
+
+/* A thread that runs a function while the loop keeps running in the thread
+ * that created it. */
+struct loop_worker;
+
+/* Start running the function in a new thread. */
+struct loop_worker *loop_worker_new(void (*function)(void *data),
+                                    void *data,
+                                    GError **error);
+
+/* Run the loop until the function of the worker returned or the timeout (if
+ * given) is reached.  Returns true if the function returned. */
+bool loop_worker_wait(struct loop_worker *worker,
+                      const struct timespec *timeout);
+
+/* Run the loop until the function of one of the given workers returned or the
+ * timeout (if given) is reached.  Returns the index of a worker whose function
+ * returned or nr_workers on timeout. */
+size_t loop_worker_wait_any(struct loop_worker *const workers[],
+                            size_t nr_workers,
+                            const struct timespec *timeout);
+
+/* Free the worker.  If its function did not return yet the worker is
+ * cancelled: the thread is left to finish on its own and all its later
+ * calls of loop_call() fail. */
+void loop_worker_free(struct loop_worker *worker);
+
+/* Call the function from the loop and wait until it returned.  This lets a
+ * worker use things that belong to the loop thread like the terminal.  Called
+ * from any other thread the function is called directly.  Returns false
+ * without calling the function if the worker was cancelled. */
+bool loop_call(void (*function)(void *data), void *data);
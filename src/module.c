@@ -15,6 +15,14 @@
  * mechanism.  They should also define dependencies if they depend on other
  * plugins of have to be called before or after other plugins. */
 
+/* To avoid mapping modules that are later dropped during dependency
+ * resolution, the dependencies and hooks of a module are read from a manifest
+ * file that is installed next to it.  This file has the same format as the
+ * output of a script's "manifest" command and is generated when the modules
+ * are built.  The module itself is only loaded when it is activated.  If the
+ * manifest is missing, older than the module or not trustworthy the module is
+ * loaded immediately and its dependencies are taken from its symbols. */
+
 #if !defined(__FreeBSD__) && !defined(_GNU_SOURCE)
 #define _GNU_SOURCE
 #endif
@@ -24,9 +32,11 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <dlfcn.h>
 
 #include <sys/types.h>
+#include <sys/stat.h>
 
 #include <glib.h>
 #include <glib-object.h>
@@ -42,11 +52,17 @@ G_DEFINE_TYPE(VlockModule, vlock_module, TYPE_VLOCK_PLUGIN)
                                                                    TYPE_VLOCK_MODULE,\
                                                                    VlockModulePrivate))
 
+/* Maximum size of a module manifest. */
+#define MANIFEST_MAX (64 * 1024)
+
 /* A hook function as defined by a module. */
 typedef bool (*module_hook_function)(void **);
 
 struct _VlockModulePrivate
 {
+  /* Path of the shared object. */
+  gchar *path;
+
   /* Handle returned by dlopen(). */
   void *dl_handle;
 
@@ -58,11 +74,117 @@ struct _VlockModulePrivate
   module_hook_function hooks[nr_hooks];
 };
 
-static bool vlock_module_open(VlockPlugin *plugin, GError **error)
+/* Read the manifest that belongs to the module at the given path.  Returns
+ * NULL if there is no usable manifest. */
+static gchar *read_manifest(const char *path, const char *manifest_path)
+{
+  struct stat module_st;
+  struct stat st;
+  gchar *data;
+  ssize_t length;
+  int fd;
+
+  if (stat(path, &module_st) < 0)
+    return NULL;
+
+  fd = open(manifest_path, O_RDONLY | O_NOFOLLOW);
+
+  if (fd < 0)
+    return NULL;
+
+  /* The manifest must not be writable by anybody but the owner of the module
+   * and must not be older than the module. */
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+      (st.st_uid != 0 && st.st_uid != module_st.st_uid) ||
+      (st.st_mode & (S_IWGRP | S_IWOTH)) != 0 ||
+      st.st_mtime < module_st.st_mtime ||
+      st.st_size >= MANIFEST_MAX) {
+    (void) close(fd);
+    return NULL;
+  }
+
+  data = g_malloc(st.st_size + 1);
+  length = read(fd, data, st.st_size);
+
+  (void) close(fd);
+
+  if (length != st.st_size) {
+    g_free(data);
+    return NULL;
+  }
+
+  data[length] = '\0';
+
+  return data;
+}
+
+/* Take the module's dependencies and hooks from its manifest. */
+static bool open_manifest(VlockModule *self)
+{
+  VlockPlugin *plugin = VLOCK_PLUGIN(self);
+  char *manifest_path = g_strdup_printf("%s/%s.manifest",
+                                        VLOCK_MODULE_DIR,
+                                        plugin->name);
+  gchar *data = read_manifest(self->priv->path, manifest_path);
+  bool result = false;
+
+  g_free(manifest_path);
+
+  if (data != NULL && vlock_plugin_is_manifest(data))
+    result = vlock_plugin_parse_manifest(plugin, data, NULL);
+
+  g_free(data);
+
+  if (!result) {
+    /* Discard whatever was parsed before the error. */
+    for (size_t i = 0; i < nr_dependencies; i++) {
+      g_list_free(plugin->dependencies[i]);
+      plugin->dependencies[i] = NULL;
+    }
+
+    for (size_t i = 0; i < nr_hooks; i++)
+      plugin->has_hook[i] = true;
+  }
+
+  return result;
+}
+
+/* Load the shared object and look up its hooks. */
+static bool load_module(VlockModule *self, GError **error)
+{
+  VlockPlugin *plugin = VLOCK_PLUGIN(self);
+
+  /* Open the module as a shared library. */
+  void *dl_handle = self->priv->dl_handle = dlopen(self->priv->path,
+                                                   RTLD_NOW | RTLD_LOCAL);
+
+  if (dl_handle == NULL) {
+    g_set_error(
+      error,
+      VLOCK_PLUGIN_ERROR,
+      VLOCK_PLUGIN_ERROR_FAILED,
+      "could not open module '%s': %s",
+      plugin->name,
+      dlerror());
+
+    return false;
+  }
+
+  /* Load all the hooks.  Unimplemented hooks are NULL and will not be called later. */
+  for (size_t i = 0; i < nr_hooks; i++) {
+    *(void **)(&self->priv->hooks[i]) = dlsym(dl_handle, hooks[i].name);
+    plugin->has_hook[i] = (self->priv->hooks[i] != NULL);
+  }
+
+  return true;
+}
+
+static bool vlock_module_locate(VlockPlugin *plugin, GError **error)
 {
   VlockModule *self = VLOCK_MODULE(plugin);
 
-  g_assert(self->priv->dl_handle == NULL);
+  if (self->priv->path != NULL)
+    return true;
 
   char *path = g_strdup_printf("%s/%s.so", VLOCK_MODULE_DIR, plugin->name);
 
@@ -85,54 +207,66 @@ static bool vlock_module_open(VlockPlugin *plugin, GError **error)
     return false;
   }
 
-  /* Open the module as a shared library. */
-  void *dl_handle = self->priv->dl_handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  self->priv->path = path;
 
-  g_free(path);
+  return true;
+}
 
-  if (dl_handle == NULL) {
-    g_set_error(
-      error,
-      VLOCK_PLUGIN_ERROR,
-      VLOCK_PLUGIN_ERROR_FAILED,
-      "could not open module '%s': %s",
-      plugin->name,
-      dlerror());
+static const gchar *vlock_module_get_path(VlockPlugin *plugin)
+{
+  return VLOCK_MODULE(plugin)->priv->path;
+}
+
+static bool vlock_module_open(VlockPlugin *plugin, GError **error)
+{
+  VlockModule *self = VLOCK_MODULE(plugin);
+
+  g_assert(self->priv->dl_handle == NULL);
 
+  if (!vlock_module_locate(plugin, error))
     return false;
-  }
 
-  /* Load all the hooks.  Unimplemented hooks are NULL and will not be called later. */
-  for (size_t i = 0; i < nr_hooks; i++)
-    *(void **)(&self->priv->hooks[i]) = dlsym(dl_handle, hooks[i].name);
+  /* Defer loading the module until it is activated. */
+  if (open_manifest(self))
+    return true;
+
+  if (!load_module(self, error))
+    return false;
 
   /* Load all dependencies.  Unspecified dependencies are NULL. */
   for (size_t i = 0; i < nr_dependencies; i++) {
-    const char *(*dependency)[] = dlsym(dl_handle, dependency_names[i]);
+    const char *(*dependency)[] = dlsym(self->priv->dl_handle,
+                                        dependency_names[i]);
 
     /* Append array elements to list. */
     for (size_t j = 0; dependency != NULL && (*dependency)[j] != NULL; j++) {
-      char *s = g_strdup((*dependency)[j]);
+      const gchar *s = g_intern_string((*dependency)[j]);
 
-      plugin->dependencies[i] = g_list_append(plugin->dependencies[i], s);
+      plugin->dependencies[i] = g_list_append(plugin->dependencies[i],
+                                              (gpointer) s);
     }
   }
 
   return true;
 }
 
-static bool vlock_module_call_hook(VlockPlugin *plugin, const gchar *hook_name)
+static bool vlock_module_activate(VlockPlugin *plugin, GError **error)
 {
   VlockModule *self = VLOCK_MODULE(plugin);
 
-  /* Find the right hook index. */
-  for (size_t i = 0; i < nr_hooks; i++)
-    if (strcmp(hooks[i].name, hook_name) == 0) {
-      module_hook_function hook = self->priv->hooks[i];
+  if (self->priv->dl_handle != NULL)
+    return true;
 
-      if (hook != NULL)
-        return hook(&self->priv->hook_context);
-    }
+  return load_module(self, error);
+}
+
+static bool vlock_module_call_hook(VlockPlugin *plugin, size_t hook)
+{
+  VlockModule *self = VLOCK_MODULE(plugin);
+  module_hook_function hook_function = self->priv->hooks[hook];
+
+  if (hook_function != NULL)
+    return hook_function(&self->priv->hook_context);
 
   return true;
 }
@@ -141,6 +275,7 @@ static bool vlock_module_call_hook(VlockPlugin *plugin, const gchar *hook_name)
 static void vlock_module_init(VlockModule *self)
 {
   self->priv = VLOCK_MODULE_GET_PRIVATE(self);
+  self->priv->path = NULL;
   self->priv->dl_handle = NULL;
 }
 
@@ -154,6 +289,8 @@ static void vlock_module_finalize(GObject *object)
     self->priv->dl_handle = NULL;
   }
 
+  g_free(self->priv->path);
+
   G_OBJECT_CLASS(vlock_module_parent_class)->finalize(object);
 }
 
@@ -169,6 +306,9 @@ static void vlock_module_class_init(VlockModuleClass *klass)
   gobject_class->finalize = vlock_module_finalize;
 
   plugin_class->open = vlock_module_open;
+  plugin_class->locate = vlock_module_locate;
+  plugin_class->get_path = vlock_module_get_path;
+  plugin_class->activate = vlock_module_activate;
   plugin_class->call_hook = vlock_module_call_hook;
 }
 
@@ -0,0 +1,439 @@
+/* plan.c -- plugin plan routines for vlock,
+ *           the VT locking program for linux
+ *
+ * This program is copyright (C) 2007 Frank Benkstein, and is free
+ * software which is freely distributable under the terms of the
+ * GNU General Public License version 2, included as the file COPYING in this
+ * distribution.  It is NOT public domain software, and any
+ * redistribution not permitted by the GNU General Public License is
+ * expressly forbidden without prior written permission from
+ * the author.
+ *
+ */
+
+/* A plan stores the result of loading the plugins given on the command line
+ * and resolving their dependencies.  It is a binary file in the byte order of
+ * the machine it was written on:
+ *
+ *   header
+ *   string offsets of the arguments, padded to a multiple of 8 bytes
+ *   entries, first the plugins in hook order, then the dropped plugins
+ *   string table
+ *
+ * Each entry holds the identity of the plugin's file.  If any of the files
+ * changed the plan is not used.  Plugins that were never opened cannot
+ * change the result. */
+
+#if !defined(__FreeBSD__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <glib.h>
+#include <glib-object.h>
+
+#include "plugin.h"
+#include "module.h"
+#include "script.h"
+
+#include "plan.h"
+
+#define PLAN_MAGIC "vlockpln"
+#define PLAN_VERSION 3
+
+/* Plans larger than this are never written and thus invalid. */
+#define PLAN_MAX (1024 * 1024)
+
+struct plan_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t nr_arguments;
+  uint32_t nr_entries;
+  /* The first nr_plugins entries are the plugins that remain. */
+  uint32_t nr_plugins;
+  uint32_t strings_size;
+  uint32_t reserved;
+};
+
+struct plan_entry
+{
+  uint32_t name;
+  uint32_t type;
+  /* Bit i is set if the plugin implements hook i. */
+  uint32_t hooks;
+  uint32_t protocol;
+  uint32_t level;
+  uint32_t reserved;
+  uint64_t device;
+  uint64_t inode;
+  uint64_t size;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  int64_t ctime_sec;
+  int64_t ctime_nsec;
+};
+
+/* Plugin types in the order they are tried when loading a plugin. */
+#define nr_plan_types 2
+
+static GType get_plan_type(size_t type)
+{
+  GType types[nr_plan_types] = { TYPE_VLOCK_MODULE, TYPE_VLOCK_SCRIPT };
+
+  return types[type];
+}
+
+static size_t get_arguments_size(size_t nr_arguments)
+{
+  return (nr_arguments * sizeof (uint32_t) + 7) & ~(size_t) 7;
+}
+
+/* Fill the identity of the given file into the entry. */
+static void set_identity(struct plan_entry *entry, const struct stat *st)
+{
+  entry->device = st->st_dev;
+  entry->inode = st->st_ino;
+  entry->size = st->st_size;
+  entry->mtime_sec = st->st_mtim.tv_sec;
+  entry->mtime_nsec = st->st_mtim.tv_nsec;
+  entry->ctime_sec = st->st_ctim.tv_sec;
+  entry->ctime_nsec = st->st_ctim.tv_nsec;
+}
+
+static bool fill_entry(struct plan_entry *entry,
+                       VlockPlugin *plugin,
+                       GString *strings,
+                       GError **error)
+{
+  const gchar *path = vlock_plugin_get_path(plugin);
+  struct stat st;
+
+  memset(entry, 0, sizeof *entry);
+
+  if (path == NULL || stat(path, &st) < 0) {
+    g_set_error(error, VLOCK_PLUGIN_ERROR, VLOCK_PLUGIN_ERROR_FAILED,
+                "could not get the file of plugin '%s'", plugin->name);
+    return false;
+  }
+
+  set_identity(entry, &st);
+
+  entry->type = IS_VLOCK_MODULE(plugin) ? 0 : 1;
+  entry->name = strings->len;
+  g_string_append_len(strings, plugin->name, strlen(plugin->name) + 1);
+
+  for (size_t i = 0; i < nr_hooks; i++)
+    if (plugin->has_hook[i])
+      entry->hooks |= 1U << i;
+
+  entry->protocol = plugin->protocol;
+  entry->level = plugin->level;
+
+  return true;
+}
+
+bool plan_write(const char *path,
+                char *const arguments[],
+                size_t nr_arguments,
+                GPtrArray *plugins,
+                GPtrArray *dropped_plugins,
+                GError **error)
+{
+  GByteArray *data = g_byte_array_new();
+  GString *strings = g_string_new(NULL);
+  struct plan_header header;
+  uint32_t *argument_offsets = g_malloc0(get_arguments_size(nr_arguments) + 1);
+  gchar *tmp_path = NULL;
+  bool result = false;
+  int fd;
+
+  memset(&header, 0, sizeof header);
+  memcpy(header.magic, PLAN_MAGIC, sizeof header.magic);
+  header.version = PLAN_VERSION;
+  header.nr_arguments = nr_arguments;
+  header.nr_plugins = plugins->len;
+  header.nr_entries = plugins->len + dropped_plugins->len;
+
+  for (size_t i = 0; i < nr_arguments; i++) {
+    argument_offsets[i] = strings->len;
+    g_string_append_len(strings, arguments[i], strlen(arguments[i]) + 1);
+  }
+
+  g_byte_array_append(data, (guint8 *) &header, sizeof header);
+  g_byte_array_append(data, (guint8 *) argument_offsets,
+                      get_arguments_size(nr_arguments));
+
+  for (size_t i = 0; i < header.nr_entries; i++) {
+    struct plan_entry entry;
+    VlockPlugin *plugin = (i < plugins->len) ?
+                          g_ptr_array_index(plugins, i) :
+                          g_ptr_array_index(dropped_plugins, i - plugins->len);
+
+    if (!fill_entry(&entry, plugin, strings, error))
+      goto out;
+
+    g_byte_array_append(data, (guint8 *) &entry, sizeof entry);
+  }
+
+  g_byte_array_append(data, (guint8 *) strings->str, strings->len);
+
+  /* Patch in the size of the string table. */
+  ((struct plan_header *) data->data)->strings_size = strings->len;
+
+  if (data->len > PLAN_MAX) {
+    g_set_error(error, VLOCK_PLUGIN_ERROR, VLOCK_PLUGIN_ERROR_FAILED,
+                "plan is too large");
+    goto out;
+  }
+
+  /* Write to a temporary file and rename it afterwards so that readers never
+   * see partial plans. */
+  tmp_path = g_strdup_printf("%s.XXXXXX", path);
+  fd = mkstemp(tmp_path);
+
+  if (fd < 0)
+    goto write_failed;
+
+  result = (fchmod(fd, 0644) == 0 &&
+            write(fd, data->data, data->len) == (ssize_t) data->len);
+
+  if (close(fd) < 0)
+    result = false;
+
+  if (result && rename(tmp_path, path) < 0)
+    result = false;
+
+  if (!result) {
+    int errsv = errno;
+    (void) unlink(tmp_path);
+    errno = errsv;
+  }
+
+write_failed:
+  if (!result)
+    g_set_error(error, VLOCK_PLUGIN_ERROR, VLOCK_PLUGIN_ERROR_FAILED,
+                "could not write plan '%s': %s", path, g_strerror(errno));
+
+out:
+  g_free(tmp_path);
+  g_free(argument_offsets);
+  g_string_free(strings, true);
+  g_byte_array_free(data, true);
+
+  return result;
+}
+
+/* Check that the plugin file of the given entry has not changed and that no
+ * plugin of a type that is tried earlier appeared.  Returns the located
+ * plugin. */
+static VlockPlugin *check_entry(const struct plan_entry *entry,
+                                const char *name,
+                                GError **error)
+{
+  VlockPlugin *plugin = NULL;
+  struct plan_entry current;
+  struct stat st;
+
+  for (size_t type = 0; type <= entry->type; type++) {
+    GError *tmp_error = NULL;
+
+    plugin = g_object_new(get_plan_type(type), "name", name, NULL);
+
+    if (vlock_plugin_locate(plugin, &tmp_error)) {
+      if (type == entry->type)
+        break;
+    } else if (type == entry->type ||
+               !g_error_matches(tmp_error,
+                                VLOCK_PLUGIN_ERROR,
+                                VLOCK_PLUGIN_ERROR_NOT_FOUND)) {
+      g_propagate_error(error, tmp_error);
+      g_object_unref(plugin);
+      return NULL;
+    } else {
+      g_clear_error(&tmp_error);
+      g_object_unref(plugin);
+      continue;
+    }
+
+    g_set_error(error, VLOCK_PLUGIN_ERROR, VLOCK_PLUGIN_ERROR_FAILED,
+                "plugin '%s' changed its type", name);
+    g_object_unref(plugin);
+    return NULL;
+  }
+
+  if (stat(vlock_plugin_get_path(plugin), &st) < 0) {
+    g_set_error(error, VLOCK_PLUGIN_ERROR, VLOCK_PLUGIN_ERROR_FAILED,
+                "could not get the file of plugin '%s': %s", name,
+                g_strerror(errno));
+    g_object_unref(plugin);
+    return NULL;
+  }
+
+  memset(&current, 0, sizeof current);
+  set_identity(&current, &st);
+
+  if (current.device != entry->device ||
+      current.inode != entry->inode ||
+      current.size != entry->size ||
+      current.mtime_sec != entry->mtime_sec ||
+      current.mtime_nsec != entry->mtime_nsec ||
+      current.ctime_sec != entry->ctime_sec ||
+      current.ctime_nsec != entry->ctime_nsec) {
+    g_set_error(error, VLOCK_PLUGIN_ERROR, VLOCK_PLUGIN_ERROR_FAILED,
+                "plugin '%s' changed", name);
+    g_object_unref(plugin);
+    return NULL;
+  }
+
+  for (size_t i = 0; i < nr_hooks; i++)
+    plugin->has_hook[i] = (entry->hooks & (1U << i)) != 0;
+
+  plugin->protocol = entry->protocol;
+  plugin->level = entry->level;
+
+  return plugin;
+}
+
+/* Get the string at the given offset of the string table or NULL if the
+ * offset is invalid.  The string table is terminated by a null byte. */
+static const char *get_string(const char *strings,
+                              size_t strings_size,
+                              uint32_t offset)
+{
+  return (offset < strings_size) ? strings + offset : NULL;
+}
+
+GPtrArray *plan_read(const char *path,
+                     char *const arguments[],
+                     size_t nr_arguments,
+                     GError **error)
+{
+  const struct plan_header *header;
+  const uint32_t *argument_offsets;
+  const struct plan_entry *entries;
+  const char *strings;
+  GPtrArray *plugins = NULL;
+  struct stat st;
+  void *data;
+  int fd;
+
+  fd = open(path, O_RDONLY | O_NOFOLLOW);
+
+  if (fd < 0) {
+    g_set_error(error, VLOCK_PLUGIN_ERROR, VLOCK_PLUGIN_ERROR_FAILED,
+                "could not open plan '%s': %s", path, g_strerror(errno));
+    return NULL;
+  }
+
+  /* The plan decides which plugins are loaded and replaces the checks of
+   * their dependencies, so only root may have written it.  A plan of the user
+   * is not trusted because vlock-main runs setuid root. */
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_uid != 0 ||
+      (st.st_mode & (S_IWGRP | S_IWOTH)) != 0 ||
+      st.st_size < (off_t) sizeof *header || st.st_size > PLAN_MAX) {
+    g_set_error(error, VLOCK_PLUGIN_ERROR, VLOCK_PLUGIN_ERROR_FAILED,
+                "plan '%s' is not trusted", path);
+    (void) close(fd);
+    return NULL;
+  }
+
+  data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  (void) close(fd);
+
+  if (data == MAP_FAILED) {
+    g_set_error(error, VLOCK_PLUGIN_ERROR, VLOCK_PLUGIN_ERROR_FAILED,
+                "could not map plan '%s': %s", path, g_strerror(errno));
+    return NULL;
+  }
+
+  header = data;
+  argument_offsets = (const uint32_t *) (header + 1);
+  entries = (const struct plan_entry *)
+            ((const char *) argument_offsets +
+             get_arguments_size(header->nr_arguments));
+  strings = (const char *) (entries + header->nr_entries);
+
+  /* Check the format.  The counts are limited first so that the sizes
+   * cannot overflow. */
+  if (memcmp(header->magic, PLAN_MAGIC, sizeof header->magic) != 0 ||
+      header->version != PLAN_VERSION ||
+      header->nr_arguments > PLAN_MAX ||
+      header->nr_entries > PLAN_MAX ||
+      header->nr_plugins > header->nr_entries ||
+      header->strings_size == 0 ||
+      (size_t) st.st_size != (size_t) (strings - (const char *) data) +
+                             header->strings_size ||
+      strings[header->strings_size - 1] != '\0') {
+    g_set_error(error, VLOCK_PLUGIN_ERROR, VLOCK_PLUGIN_ERROR_FAILED,
+                "plan '%s' is invalid", path);
+    goto out;
+  }
+
+  if (header->nr_arguments != nr_arguments) {
+    g_set_error(error, VLOCK_PLUGIN_ERROR, VLOCK_PLUGIN_ERROR_FAILED,
+                "plan '%s' is for different plugins", path);
+    goto out;
+  }
+
+  for (size_t i = 0; i < nr_arguments; i++) {
+    const char *argument = get_string(strings, header->strings_size,
+                                      argument_offsets[i]);
+
+    if (argument == NULL || strcmp(argument, arguments[i]) != 0) {
+      g_set_error(error, VLOCK_PLUGIN_ERROR, VLOCK_PLUGIN_ERROR_FAILED,
+                  "plan '%s' is for different plugins", path);
+      goto out;
+    }
+  }
+
+  plugins = g_ptr_array_new();
+
+  for (size_t i = 0; i < header->nr_entries; i++) {
+    const struct plan_entry *entry = &entries[i];
+    const char *name = get_string(strings, header->strings_size, entry->name);
+    VlockPlugin *plugin;
+
+    if (name == NULL || entry->type >= nr_plan_types) {
+      g_set_error(error, VLOCK_PLUGIN_ERROR, VLOCK_PLUGIN_ERROR_FAILED,
+                  "plan '%s' is invalid", path);
+      goto failed;
+    }
+
+    plugin = check_entry(entry, name, error);
+
+    if (plugin == NULL)
+      goto failed;
+
+    /* Dropped plugins are only checked. */
+    if (i < header->nr_plugins)
+      g_ptr_array_add(plugins, plugin);
+    else
+      g_object_unref(plugin);
+  }
+
+  goto out;
+
+failed:
+  for (size_t i = 0; i < plugins->len; i++)
+    g_object_unref(g_ptr_array_index(plugins, i));
+
+  g_ptr_array_free(plugins, true);
+  plugins = NULL;
+
+out:
+  (void) munmap(data, st.st_size);
+
+  return plugins;
+}
@@ -0,0 +1,40 @@
+/* plan.h -- header file for the plugin plan routines for vlock,
+ *           the VT locking program for linux
+ *
+ * This program is copyright (C) 2007 Frank Benkstein, and is free
+ * software which is freely distributable under the terms of the
+ * GNU General Public License version 2, included as the file COPYING in this
+ * distribution.  It is NOT public domain software, and any
+ * redistribution not permitted by the GNU General Public License is
+ * expressly forbidden without prior written permission from
+ * the author.
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <glib.h>
+
+#include "plugin.h"
+
+/* Write a plan for the given plugin arguments to the given file.  The plugins
+ * are the plugins that remain after resolving the dependencies in the order
+ * their hooks are called.  Dropped plugins are all plugins that were opened
+ * while resolving the dependencies but did not remain.  Their files are
+ * checked, too, when the plan is read. */
+bool plan_write(const char *path,
+                char *const arguments[],
+                size_t nr_arguments,
+                GPtrArray *plugins,
+                GPtrArray *dropped_plugins,
+                GError **error);
+
+/* Read the plan from the given file.  Returns the located but not opened
+ * plugins in the order their hooks are called.  Fails if the plan was written
+ * for other arguments, if any of the plugin files changed or if the file is
+ * not owned by root or writable by anybody else. */
+GPtrArray *plan_read(const char *path,
+                     char *const arguments[],
+                     size_t nr_arguments,
+                     GError **error);
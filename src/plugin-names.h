@@ -0,0 +1,36 @@
+/* plugin-names.h -- names of plugin dependencies and hooks for vlock,
+ *                   the VT locking program for linux
+ *
+ * This program is copyright (C) 2007 Frank Benkstein, and is free
+ * software which is freely distributable under the terms of the
+ * GNU General Public License version 2, included as the file COPYING in this
+ * distribution.  It is NOT public domain software, and any
+ * redistribution not permitted by the GNU General Public License is
+ * expressly forbidden without prior written permission from
+ * the author.
+ *
+ */
+
+#pragma once
+
+/* The dependencies and hooks in the order of their indices in plugin.h.  Each
+ * macro calls the given macro with the name of every entry.  This header has
+ * no other dependencies so that the module-manifest tool can share the lists
+ * without linking against vlock-main. */
+
+#define FOR_EACH_DEPENDENCY(X) \
+  X(succeeds) \
+  X(preceeds) \
+  X(requires) \
+  X(needs) \
+  X(depends) \
+  X(conflicts)
+
+#define FOR_EACH_HOOK(X) \
+  X(vlock_start) \
+  X(vlock_end) \
+  X(vlock_save) \
+  X(vlock_save_abort)
+
+/* Expands to the name of an entry as a string and a comma. */
+#define PLUGIN_NAME_STRING(name) #name,
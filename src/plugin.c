@@ -32,8 +32,13 @@ static void vlock_plugin_init(VlockPlugin *self)
 {
   self->name = NULL;
   self->save_disabled = false;
+  self->protocol = 0;
+  self->level = 0;
   for (size_t i = 0; i < nr_dependencies; i++)
     self->dependencies[i] = NULL;
+  /* Unless told otherwise assume that all hooks are implemented. */
+  for (size_t i = 0; i < nr_hooks; i++)
+    self->has_hook[i] = true;
 }
 
 /* Create new plugin object. */
@@ -58,13 +63,10 @@ static void vlock_plugin_finalize(GObject *object)
   g_free(self->name);
   self->name = NULL;
 
-  /* Destroy dependency lists. */
+  /* Destroy dependency lists.  The names are interned and not freed. */
   for (size_t i = 0; i < nr_dependencies; i++) {
-    while (self->dependencies[i] != NULL) {
-      g_free(self->dependencies[i]->data);
-      self->dependencies[i] = g_list_delete_link(self->dependencies[i],
-                                                 self->dependencies[i]);
-    }
+    g_list_free(self->dependencies[i]);
+    self->dependencies[i] = NULL;
   }
 
   G_OBJECT_CLASS(vlock_plugin_parent_class)->finalize(object);
@@ -134,7 +136,14 @@ static void vlock_plugin_class_init(VlockPluginClass *klass)
 
   /* Virtual methods. */
   klass->open = NULL;
+  klass->locate = NULL;
+  klass->get_path = NULL;
+  klass->activate = NULL;
+  klass->release = NULL;
   klass->call_hook = NULL;
+  klass->post_hook = NULL;
+  klass->complete_hook = NULL;
+  klass->get_hook_fd = NULL;
 
   /* Install overridden methods. */
   gobject_class->constructor = vlock_plugin_constructor;
@@ -165,10 +174,178 @@ bool vlock_plugin_open(VlockPlugin *self, GError **error)
   return klass->open(self, error);
 }
 
-bool vlock_plugin_call_hook(VlockPlugin *self, const gchar *hook_name)
+bool vlock_plugin_locate(VlockPlugin *self, GError **error)
+{
+  VlockPluginClass *klass = VLOCK_PLUGIN_GET_CLASS(self);
+  g_assert(klass->locate != NULL);
+  return klass->locate(self, error);
+}
+
+const gchar *vlock_plugin_get_path(VlockPlugin *self)
+{
+  VlockPluginClass *klass = VLOCK_PLUGIN_GET_CLASS(self);
+  g_assert(klass->get_path != NULL);
+  return klass->get_path(self);
+}
+
+bool vlock_plugin_activate(VlockPlugin *self, GError **error)
+{
+  VlockPluginClass *klass = VLOCK_PLUGIN_GET_CLASS(self);
+
+  /* Activation is optional. */
+  if (klass->activate == NULL)
+    return true;
+
+  return klass->activate(self, error);
+}
+
+void vlock_plugin_release(VlockPlugin *self, GArray *pids)
+{
+  VlockPluginClass *klass = VLOCK_PLUGIN_GET_CLASS(self);
+
+  /* Only plugins with child processes need to release them. */
+  if (klass->release != NULL)
+    klass->release(self, pids);
+}
+
+bool vlock_plugin_call_hook(VlockPlugin *self, size_t hook)
 {
   VlockPluginClass *klass = VLOCK_PLUGIN_GET_CLASS(self);
   g_assert(klass->call_hook != NULL);
-  return klass->call_hook(self, hook_name);
+  g_assert(hook < nr_hooks);
+  return klass->call_hook(self, hook);
+}
+
+
+/* The first line of a manifest.  The number is the version of the format. */
+#define MANIFEST_HEADER "vlock-manifest 1"
+
+bool vlock_plugin_is_manifest(const char *data)
+{
+  size_t header_length = strlen(MANIFEST_HEADER);
+
+  return strncmp(data, MANIFEST_HEADER, header_length) == 0 &&
+         (data[header_length] == '\n' || data[header_length] == '\0');
 }
 
+/* Find the index of the named dependency or return nr_dependencies if there is
+ * no such dependency. */
+static size_t dependency_index(const char *name)
+{
+  size_t i;
+
+  for (i = 0; i < nr_dependencies; i++)
+    if (strcmp(dependency_names[i], name) == 0)
+      break;
+
+  return i;
+}
+
+/* Mark exactly the given hooks as implemented.  Unknown hooks are ignored. */
+static void parse_hooks(VlockPlugin *self, char **hook_names)
+{
+  for (size_t i = 0; i < nr_hooks; i++) {
+    self->has_hook[i] = false;
+
+    for (size_t j = 0; hook_names[j] != NULL; j++)
+      if (strcmp(hooks[i].name, hook_names[j]) == 0)
+        self->has_hook[i] = true;
+  }
+}
+
+bool vlock_plugin_parse_manifest(VlockPlugin *self,
+                                 const char *data,
+                                 GError **error)
+{
+  char **lines;
+
+  if (!vlock_plugin_is_manifest(data)) {
+    g_set_error(error, VLOCK_PLUGIN_ERROR, VLOCK_PLUGIN_ERROR_FAILED,
+                "manifest of plugin '%s' has no valid header", self->name);
+    return false;
+  }
+
+  lines = g_strsplit(data, "\n", -1);
+
+  /* Skip the header. */
+  for (size_t i = 1; lines[i] != NULL; i++) {
+    char *line = g_strstrip(lines[i]);
+    char *colon = strchr(line, ':');
+    char **items;
+    size_t index;
+
+    /* Skip empty lines. */
+    if (*line == '\0')
+      continue;
+
+    if (colon == NULL) {
+      g_set_error(error, VLOCK_PLUGIN_ERROR, VLOCK_PLUGIN_ERROR_FAILED,
+                  "manifest of plugin '%s' has an invalid line: %s",
+                  self->name, line);
+      g_strfreev(lines);
+      return false;
+    }
+
+    *colon = '\0';
+    items = g_strsplit_set(g_strstrip(colon+1), " \t\r", -1);
+
+    if (strcmp(g_strstrip(line), "hooks") == 0) {
+      parse_hooks(self, items);
+    } else if (strcmp(line, "protocol") == 0) {
+      self->protocol = (items[0] != NULL) ? strtoul(items[0], NULL, 10) : 0;
+    } else {
+      index = dependency_index(line);
+
+      /* Ignore unknown keys so that newer manifests can be read. */
+      if (index < nr_dependencies)
+        for (size_t j = 0; items[j] != NULL; j++)
+          if (*items[j] != '\0')
+            self->dependencies[index] = g_list_append(
+              self->dependencies[index],
+              (gpointer) g_intern_string(items[j]));
+    }
+
+    g_strfreev(items);
+  }
+
+  g_strfreev(lines);
+
+  return true;
+}
+
+gchar *vlock_plugin_format_manifest(VlockPlugin *self)
+{
+  GString *manifest = g_string_new(MANIFEST_HEADER "\n");
+
+  for (size_t i = 0; i < nr_dependencies; i++) {
+    if (self->dependencies[i] == NULL)
+      continue;
+
+    g_string_append_printf(manifest, "%s:", dependency_names[i]);
+
+    for (GList *item = self->dependencies[i];
+         item != NULL;
+         item = g_list_next(item))
+      g_string_append_printf(manifest, " %s", (const char *) item->data);
+
+    g_string_append_c(manifest, '\n');
+  }
+
+  /* Leaving out the hooks means all hooks. */
+  for (size_t i = 0; i < nr_hooks; i++)
+    if (!self->has_hook[i]) {
+      g_string_append(manifest, "hooks:");
+
+      for (size_t j = 0; j < nr_hooks; j++)
+        if (self->has_hook[j])
+          g_string_append_printf(manifest, " %s", hooks[j].name);
+
+      g_string_append_c(manifest, '\n');
+      break;
+    }
+
+  if (self->protocol > 0)
+    g_string_append_printf(manifest, "protocol: %u\n", self->protocol);
+
+  return g_string_free(manifest, false);
+}
@@ -17,21 +17,36 @@
 #include <glib.h>
 #include <glib-object.h>
 
-/* Names of dependencies plugins may specify. */
+#include "plugin-names.h"
+
+/* Names of dependencies plugins may specify.  The plugin names in the
+ * dependency lists are interned with g_intern_string(). */
 #define nr_dependencies 6
 extern const char *dependency_names[nr_dependencies];
 
+#define SUCCEEDS 0
+#define PRECEEDS 1
+#define REQUIRES 2
+#define NEEDS 3
+#define DEPENDS 4
+#define CONFLICTS 5
+
 /* A plugin hook consists of a name and a handler function. */
 struct hook
 {
   const char *name;
-  void (*handler)(const char *);
+  void (*handler)(void);
 };
 
-/* Hooks that a plugin may define. */
+/* Hooks that a plugin may define.  Hooks are referred to by their index. */
 #define nr_hooks 4
 extern const struct hook hooks[nr_hooks];
 
+#define HOOK_VLOCK_START 0
+#define HOOK_VLOCK_END 1
+#define HOOK_VLOCK_SAVE 2
+#define HOOK_VLOCK_SAVE_ABORT 3
+
 /* Errors */
 #define VLOCK_PLUGIN_ERROR vlock_plugin_error_quark()
 GQuark vlock_plugin_error_quark(void);
@@ -70,6 +85,18 @@ struct _VlockPlugin
 
   GList *dependencies[nr_dependencies];
 
+  /* Which of the hooks the plugin implements. */
+  bool has_hook[nr_hooks];
+
+  /* The version of the hook protocol the plugin speaks as declared in its
+   * manifest.  0 if it does not acknowledge hooks. */
+  unsigned int protocol;
+
+  /* The hooks of the plugin are called after those of all plugins on lower
+   * levels and together with those of other plugins on the same level.  Set
+   * when the plugins are sorted. */
+  unsigned int level;
+
   bool save_disabled;
 };
 
@@ -78,14 +105,65 @@ struct _VlockPluginClass
   GObjectClass parent_class;
 
   bool (*open)(VlockPlugin *self, GError **error);
-  bool (*call_hook)(VlockPlugin *self, const gchar *hook_name);
+  bool (*locate)(VlockPlugin *self, GError **error);
+  const gchar *(*get_path)(VlockPlugin *self);
+  bool (*activate)(VlockPlugin *self, GError **error);
+  void (*release)(VlockPlugin *self, GArray *pids);
+  bool (*call_hook)(VlockPlugin *self, size_t hook);
+  /* Optional.  Calling a hook may be split into starting the hook and
+   * waiting for its result until the given monotonic deadline so that other
+   * hooks can run in between.  The second method is only called if the first
+   * succeeded. */
+  bool (*post_hook)(VlockPlugin *self, size_t hook);
+  bool (*complete_hook)(VlockPlugin *self, size_t hook, gint64 deadline);
+  /* Optional.  Get a descriptor that becomes readable when the result of a
+   * posted hook may be available, or -1. */
+  int (*get_hook_fd)(VlockPlugin *self);
 };
 
+/* How long a plugin has to report the result of a posted hook. */
+#define HOOK_ACK_TIMEOUT_USEC 1000000L
+
 GType vlock_plugin_get_type(void);
 
-/* Open the plugin. */
+/* Open the plugin.  This only reads the plugin's dependencies and which hooks
+ * it implements. */
 bool vlock_plugin_open(VlockPlugin *self, GError **error);
 
+/* Find the plugin's file and check that it may be used without reading the
+ * plugin's dependencies.  Fails with VLOCK_PLUGIN_ERROR_NOT_FOUND if there is
+ * no such plugin. */
+bool vlock_plugin_locate(VlockPlugin *self, GError **error);
+
+/* Get the path of the plugin's file.  Returns NULL if the plugin was neither
+ * opened nor located. */
+const gchar *vlock_plugin_get_path(VlockPlugin *self);
+
+/* Prepare the plugin for calling its hooks.  This is done only for plugins that
+ * remain after the dependencies are resolved. */
+bool vlock_plugin_activate(VlockPlugin *self, GError **error);
+
+/* Ask the plugin's child processes to exit without waiting for them.  Their
+ * PIDs are appended to the given array of pid_t.  The caller must wait for
+ * them. */
+void vlock_plugin_release(VlockPlugin *self, GArray *pids);
+
 GList *vlock_plugin_get_dependencies(VlockPlugin *self,
                                      const gchar *dependency_name);
-bool vlock_plugin_call_hook(VlockPlugin *self, const gchar *hook_name);
+bool vlock_plugin_call_hook(VlockPlugin *self, size_t hook);
+
+/* Check if the given data starts with a manifest header. */
+bool vlock_plugin_is_manifest(const char *data);
+
+/* Parse the given manifest data and append the declared dependencies to the
+ * plugin's dependency lists.  Each line after the header has the form
+ * "<dependency>: <plugin> <plugin> ...".  A line of the form
+ * "hooks: <hook> <hook> ..." declares which hooks the plugin implements.
+ * Unknown keys are ignored. */
+bool vlock_plugin_parse_manifest(VlockPlugin *self,
+                                 const char *data,
+                                 GError **error);
+
+/* Format the plugin's dependencies and hooks as a manifest.  The result should be freed
+ * with g_free(). */
+gchar *vlock_plugin_format_manifest(VlockPlugin *self);
@@ -15,126 +15,403 @@
 #include <string.h>
 #include <errno.h>
 #include <assert.h>
+#include <poll.h>
 
 #include <glib.h>
 
 #include "plugins.h"
 
 #include "tsort.h"
+#include "resolve.h"
+#include "plan.h"
 
 #include "plugin.h"
 #include "module.h"
 #include "script.h"
 
+#include "process.h"
 #include "util.h"
 
-/* the list of plugins */
-static GList *plugins = NULL;
+/* The plugins in the order their hooks are called. */
+static GPtrArray *plugins = NULL;
+
+/* The same plugins indexed by their interned names. */
+static GHashTable *plugin_table = NULL;
+
+/* Plugins that were loaded by preload_plugins() but not yet requested through
+ * load_plugin() and the errors of those that could not be loaded.  Both are
+ * indexed by the requested name. */
+static GHashTable *preloaded_plugins = NULL;
+static GHashTable *preload_errors = NULL;
+
+/* All plugins that were opened since record_opened_plugins() was called.  NULL
+ * if they are not recorded. */
+static GPtrArray *opened_plugins = NULL;
 
 /****************/
 /* dependencies */
 /****************/
 
-#define SUCCEEDS 0
-#define PRECEEDS 1
-#define REQUIRES 2
-#define NEEDS 3
-#define DEPENDS 4
-#define CONFLICTS 5
-
 const char *dependency_names[nr_dependencies] = {
-  "succeeds",
-  "preceeds",
-  "requires",
-  "needs",
-  "depends",
-  "conflicts",
+  FOR_EACH_DEPENDENCY(PLUGIN_NAME_STRING)
 };
 
 /*********/
 /* hooks */
 /*********/
 
-static void handle_vlock_start(const char * hook_name);
-static void handle_vlock_end(const char * hook_name);
-static void handle_vlock_save(const char * hook_name);
-static void handle_vlock_save_abort(const char * hook_name);
+static void handle_vlock_start(void);
+static void handle_vlock_end(void);
+static void handle_vlock_save(void);
+static void handle_vlock_save_abort(void);
+
+#define HOOK_ENTRY(name) { #name, handle_##name },
 
 const struct hook hooks[nr_hooks] = {
-  { "vlock_start", handle_vlock_start },
-  { "vlock_end", handle_vlock_end },
-  { "vlock_save", handle_vlock_save },
-  { "vlock_save_abort", handle_vlock_save_abort },
+  FOR_EACH_HOOK(HOOK_ENTRY)
+};
+
+#undef HOOK_ENTRY
+
+/* An entry of a dispatch vector. */
+struct dispatch_entry
+{
+  VlockPlugin *plugin;
+  /* The hook methods of the plugin's class. */
+  bool (*call_hook)(VlockPlugin *self, size_t hook);
+  bool (*post_hook)(VlockPlugin *self, size_t hook);
+  bool (*complete_hook)(VlockPlugin *self, size_t hook, gint64 deadline);
+  int (*get_hook_fd)(VlockPlugin *self);
+  /* The index of the plugin in the list of plugins. */
+  size_t position;
 };
 
+/* For each hook the plugins that implement it, in the same order as the list
+ * of plugins.  Plugins on the same level are adjacent.  Built by
+ * activate_plugins(). */
+static GArray *dispatch[nr_hooks];
+
 /**********************/
 /* exported functions */
 /**********************/
 
 /* helper declarations */
 static VlockPlugin *__load_plugin(const char *name, GError **error);
+static VlockPlugin *open_plugin(const char *name, GError **error);
+static VlockPlugin *get_plugin(const gchar *name);
+static void add_plugin(VlockPlugin *p);
 static bool __resolve_depedencies(GError **error);
 static bool sort_plugins(GError **error);
+static void assign_levels(void);
+static void build_dispatch_vectors(void);
 
 bool load_plugin(const char *name, GError **error)
 {
   return __load_plugin(name, error) != NULL;
 }
 
+/* Check if the name at the given index occurs before. */
+static bool is_duplicate(char *const names[], size_t index)
+{
+  for (size_t i = 0; i < index; i++)
+    if (strcmp(names[i], names[index]) == 0)
+      return true;
+
+  return false;
+}
+
+void preload_plugins(char *const names[], size_t nr_names)
+{
+  GPtrArray *script_names = g_ptr_array_new();
+  GPtrArray *scripts = g_ptr_array_new();
+  GError **script_errors;
+
+  if (preloaded_plugins == NULL) {
+    preloaded_plugins = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                              g_free, g_object_unref);
+    preload_errors = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                           g_free,
+                                           (GDestroyNotify) g_error_free);
+  }
+
+  for (size_t i = 0; i < nr_names; i++) {
+    const char *name = names[i];
+    GError *err = NULL;
+    VlockPlugin *p;
+
+    if (get_plugin(g_intern_string(name)) != NULL ||
+        g_hash_table_lookup(preloaded_plugins, name) != NULL ||
+        g_hash_table_lookup(preload_errors, name) != NULL ||
+        is_duplicate(names, i))
+      continue;
+
+    /* Modules are cheap to open and are tried first, see open_plugin(). */
+    p = g_object_new(TYPE_VLOCK_MODULE, "name", name, NULL);
+
+    if (vlock_plugin_open(p, &err)) {
+      g_hash_table_insert(preloaded_plugins, g_strdup(name), p);
+      continue;
+    }
+
+    g_object_unref(p);
+
+    if (!g_error_matches(err, VLOCK_PLUGIN_ERROR, VLOCK_PLUGIN_ERROR_NOT_FOUND)) {
+      g_hash_table_insert(preload_errors, g_strdup(name), err);
+      continue;
+    }
+
+    g_clear_error(&err);
+
+    g_ptr_array_add(script_names, (gpointer) name);
+    g_ptr_array_add(scripts, g_object_new(TYPE_VLOCK_SCRIPT, "name", name,
+                                          NULL));
+  }
+
+  /* Scripts have to be started to get their dependencies.  Start them all at
+   * once. */
+  script_errors = g_new(GError *, scripts->len);
+
+  vlock_script_open_all((VlockScript **) scripts->pdata,
+                        script_errors,
+                        scripts->len);
+
+  for (size_t i = 0; i < scripts->len; i++) {
+    gchar *name = g_strdup(g_ptr_array_index(script_names, i));
+
+    if (script_errors[i] == NULL) {
+      g_hash_table_insert(preloaded_plugins, name,
+                          g_ptr_array_index(scripts, i));
+    } else {
+      g_hash_table_insert(preload_errors, name, script_errors[i]);
+      g_object_unref(g_ptr_array_index(scripts, i));
+    }
+  }
+
+  g_free(script_errors);
+  g_ptr_array_free(scripts, true);
+  g_ptr_array_free(script_names, true);
+}
+
 bool resolve_dependencies(GError **error)
 {
   return __resolve_depedencies(error) && sort_plugins(error);
 }
 
-void unload_plugins(void)
+bool activate_plugins(GError **error)
+{
+  for (size_t i = 0; plugins != NULL && i < plugins->len; i++)
+    if (!vlock_plugin_activate(g_ptr_array_index(plugins, i), error))
+      return false;
+
+  /* Activating a module may change the hooks it is known to implement. */
+  build_dispatch_vectors();
+
+  return true;
+}
+
+void record_opened_plugins(void)
 {
-  while (plugins != NULL) {
-    g_object_unref(plugins->data);
-    plugins = g_list_delete_link(plugins, plugins);
+  if (opened_plugins == NULL)
+    opened_plugins = g_ptr_array_new();
+}
+
+bool write_plan(const char *path,
+                char *const names[],
+                size_t nr_names,
+                GError **error)
+{
+  GPtrArray *loaded_plugins = (plugins != NULL) ? plugins : g_ptr_array_new();
+  GPtrArray *dropped_plugins = g_ptr_array_new();
+  bool result;
+
+  g_assert(opened_plugins != NULL);
+
+  /* Plugins that were opened but dropped while resolving the dependencies
+   * must not change either. */
+  for (size_t i = 0; i < opened_plugins->len; i++) {
+    VlockPlugin *p = g_ptr_array_index(opened_plugins, i);
+
+    if (get_plugin(g_intern_string(p->name)) != p)
+      g_ptr_array_add(dropped_plugins, p);
   }
+
+  result = plan_write(path, names, nr_names, loaded_plugins, dropped_plugins,
+                      error);
+
+  g_ptr_array_free(dropped_plugins, true);
+
+  if (loaded_plugins != plugins)
+    g_ptr_array_free(loaded_plugins, true);
+
+  return result;
 }
 
-void plugin_hook(const char *hook_name)
+bool load_plan(const char *path,
+               char *const names[],
+               size_t nr_names,
+               GError **error)
+{
+  GPtrArray *planned_plugins;
+
+  g_assert(plugins == NULL);
+
+  planned_plugins = plan_read(path, names, nr_names, error);
+
+  if (planned_plugins == NULL)
+    return false;
+
+  for (size_t i = 0; i < planned_plugins->len; i++)
+    add_plugin(g_ptr_array_index(planned_plugins, i));
+
+  g_ptr_array_free(planned_plugins, true);
+
+  return true;
+}
+
+void unload_plugins(void)
 {
+  if (opened_plugins != NULL) {
+    for (size_t i = 0; i < opened_plugins->len; i++)
+      g_object_unref(g_ptr_array_index(opened_plugins, i));
+
+    g_ptr_array_free(opened_plugins, true);
+    opened_plugins = NULL;
+  }
+
+  if (preloaded_plugins != NULL) {
+    g_hash_table_destroy(preloaded_plugins);
+    g_hash_table_destroy(preload_errors);
+    preloaded_plugins = NULL;
+    preload_errors = NULL;
+  }
+
   for (size_t i = 0; i < nr_hooks; i++)
-    /* Get the handler and call it. */
-    if (strcmp(hook_name, hooks[i].name) == 0) {
-      hooks[i].handler(hook_name);
-      break;
+    if (dispatch[i] != NULL) {
+      g_array_free(dispatch[i], true);
+      dispatch[i] = NULL;
+    }
+
+  if (plugins != NULL) {
+    GArray *pids = g_array_new(false, false, sizeof (pid_t));
+    bool *dead;
+
+    /* Let all child processes exit at the same time instead of waiting for
+     * each when its plugin is destroyed. */
+    for (size_t i = 0; i < plugins->len; i++)
+      vlock_plugin_release(g_ptr_array_index(plugins, i), pids);
+
+    dead = g_new0(bool, pids->len);
+
+    if (!wait_for_deaths((pid_t *) pids->data, dead, pids->len, 0, 500000L)) {
+      GArray *remaining = g_array_new(false, false, sizeof (pid_t));
+
+      for (size_t i = 0; i < pids->len; i++)
+        if (!dead[i])
+          g_array_append_val(remaining, g_array_index(pids, pid_t, i));
+
+      ensure_deaths((pid_t *) remaining->data, remaining->len);
+      g_array_free(remaining, true);
     }
+
+    g_free(dead);
+    g_array_free(pids, true);
+
+    for (size_t i = 0; i < plugins->len; i++)
+      g_object_unref(g_ptr_array_index(plugins, i));
+
+    g_ptr_array_free(plugins, true);
+    g_hash_table_destroy(plugin_table);
+    plugins = NULL;
+    plugin_table = NULL;
+  }
+}
+
+void plugin_hook(size_t hook)
+{
+  g_assert(hook < nr_hooks);
+  /* Find out which children died since the last hook. */
+  reap_children();
+  hooks[hook].handler();
 }
 
 /********************/
 /* helper functions */
 /********************/
 
-static gint plugin_name_compare(VlockPlugin *p, const char *name)
+/* Get the plugin with the given name.  The name must be interned. */
+static VlockPlugin *get_plugin(const gchar *name)
 {
-  return strcmp(name, p->name);
+  if (plugin_table == NULL)
+    return NULL;
+
+  return g_hash_table_lookup(plugin_table, name);
 }
 
-static VlockPlugin *get_plugin(const char *name)
+/* Append the plugin to the list of plugins. */
+static void add_plugin(VlockPlugin *p)
 {
-  GList *item = g_list_find_custom(plugins,
-                                   name,
-                                   (GCompareFunc) plugin_name_compare);
+  if (plugins == NULL) {
+    plugins = g_ptr_array_new();
+    plugin_table = g_hash_table_new(g_direct_hash, g_direct_equal);
+  }
 
-  if (item != NULL)
-    return item->data;
-  else
-    return NULL;
+  g_ptr_array_add(plugins, p);
+  g_hash_table_insert(plugin_table, (gpointer) g_intern_string(p->name), p);
 }
 
 /* Load and return the named plugin. */
 static VlockPlugin *__load_plugin(const char *name, GError **error)
 {
-  VlockPlugin *p = get_plugin(name);
+  VlockPlugin *p = get_plugin(g_intern_string(name));
 
-  if (p != NULL)
-    return p;
+  if (p == NULL) {
+    p = open_plugin(name, error);
+
+    if (p != NULL)
+      add_plugin(p);
+  }
+
+  return p;
+}
+
+static VlockPlugin *__open_plugin(const char *name, GError **error);
+
+/* Open the named plugin without adding it to the list of plugins. */
+static VlockPlugin *open_plugin(const char *name, GError **error)
+{
+  VlockPlugin *p = __open_plugin(name, error);
+
+  if (p != NULL && opened_plugins != NULL)
+    g_ptr_array_add(opened_plugins, g_object_ref(p));
+
+  return p;
+}
 
+static VlockPlugin *__open_plugin(const char *name, GError **error)
+{
+  VlockPlugin *p = NULL;
   GError *err = NULL;
 
+  /* Use the result of preload_plugins() if there is one. */
+  if (preloaded_plugins != NULL) {
+    gpointer key;
+
+    if (g_hash_table_lookup_extended(preloaded_plugins, name, &key,
+                                     (gpointer *) &p)) {
+      g_hash_table_steal(preloaded_plugins, name);
+      g_free(key);
+      return p;
+    }
+
+    if (g_hash_table_lookup_extended(preload_errors, name, &key,
+                                     (gpointer *) &err)) {
+      g_hash_table_steal(preload_errors, name);
+      g_free(key);
+      g_propagate_error(error, err);
+      return NULL;
+    }
+  }
+
   /* Possible plugin types. */
   GType plugin_types[] = { TYPE_VLOCK_MODULE, TYPE_VLOCK_SCRIPT, 0 };
 
@@ -171,143 +448,51 @@ static VlockPlugin *__load_plugin(const char *name, GError **error)
   } else {
     g_assert(p != NULL);
 
-    plugins = g_list_append(plugins, p);
-
     return p;
   }
 }
 
-/* Resolve the dependencies of the plugins. */
-static bool __resolve_depedencies(GError **error)
+static const char *get_plugin_name(void *p)
 {
-  GList *required_plugins = NULL;
-
-  /* Load plugins that are required.  This automagically takes care of plugins
-   * that are required by the plugins loaded here because they are appended to
-   * the end of the list. */
-  for (GList *plugin_item = plugins;
-       plugin_item != NULL;
-       plugin_item = g_list_next(plugin_item)) {
-    VlockPlugin *p = plugin_item->data;
-
-    for (GList *dependency_item = p->dependencies[REQUIRES];
-         dependency_item != NULL;
-         dependency_item = g_list_next(dependency_item)) {
-      const char *d = dependency_item->data;
-      VlockPlugin *q = __load_plugin(d, NULL);
-
-      if (q == NULL) {
-        g_set_error(
-          error,
-          VLOCK_PLUGIN_ERROR,
-          VLOCK_PLUGIN_ERROR_DEPENDENCY,
-          "'%s' requires '%s' which could not be loaded", p->name, d);
-        g_list_free(required_plugins);
-        return false;
-      }
+  return VLOCK_PLUGIN(p)->name;
+}
 
-      required_plugins = g_list_append(required_plugins, p);
-    }
-  }
+static GList *get_plugin_dependencies(void *p, size_t dependency)
+{
+  return VLOCK_PLUGIN(p)->dependencies[dependency];
+}
 
-  /* Fail if a plugins that is needed is not loaded. */
-  for (GList *plugin_item = plugins;
-       plugin_item != NULL;
-       plugin_item = g_list_next(plugin_item)) {
-    VlockPlugin *p = plugin_item->data;
-
-    for (GList *dependency_item = p->dependencies[NEEDS];
-         dependency_item != NULL;
-         dependency_item = g_list_next(dependency_item)) {
-      const char *d = dependency_item->data;
-      VlockPlugin *q = get_plugin(d);
-
-      if (q == NULL) {
-        g_set_error(
-          error,
-          VLOCK_PLUGIN_ERROR,
-          VLOCK_PLUGIN_ERROR_DEPENDENCY,
-          "'%s' needs '%s' which is not loaded", p->name, d);
-        g_list_free(required_plugins);
-        errno = 0;
-        return false;
-      }
+static void *open_required_plugin(const char *name)
+{
+  return open_plugin(name, NULL);
+}
 
-      required_plugins = g_list_append(required_plugins, q);
-    }
-  }
+static const struct resolve_ops plugin_resolve_ops = {
+  get_plugin_name,
+  get_plugin_dependencies,
+  open_required_plugin,
+  g_object_unref,
+};
 
-  /* Unload plugins whose prerequisites are not present, fail if those plugins
-   * are required. */
-  for (GList *plugin_item = plugins;
-       plugin_item != NULL; ) {
-    VlockPlugin *p = plugin_item->data;
-    bool dependencies_loaded = true;
-
-    for (GList *dependency_item = p->dependencies[DEPENDS];
-         dependency_item != NULL;
-         dependency_item = g_list_next(dependency_item)) {
-      const char *d = dependency_item->data;
-      VlockPlugin *q = get_plugin(d);
-
-      if (q == NULL) {
-        dependencies_loaded = false;
-
-        /* Abort if dependencies not met and plugin is required. */
-        if (g_list_find(required_plugins, p) != NULL) {
-          g_set_error(
-            error,
-            VLOCK_PLUGIN_ERROR,
-            VLOCK_PLUGIN_ERROR_DEPENDENCY,
-            "'%s' is required by some other plugin but depends on '%s' which is not loaded",
-            p->name,
-            d);
-          g_list_free(required_plugins);
-          errno = 0;
-          return false;
-        }
-
-        break;
-      }
-    }
+/* Resolve the dependencies of the plugins. */
+static bool __resolve_depedencies(GError **error)
+{
+  bool result;
 
-    GList *next_plugin_item = g_list_next(plugin_item);
+  if (plugins == NULL)
+    return true;
 
-    if (!dependencies_loaded) {
-      g_object_unref(p);
-      plugins = g_list_delete_link(plugins, plugin_item);
-    }
+  result = resolve_plugins(plugins, &plugin_resolve_ops, error);
 
-    plugin_item = next_plugin_item;
-  }
+  /* Plugins may have been added or dropped. */
+  g_hash_table_remove_all(plugin_table);
 
-  g_list_free(required_plugins);
-
-  /* Fail if conflicting plugins are loaded. */
-  for (GList *plugin_item = plugins;
-       plugin_item != NULL;
-       plugin_item = g_list_next(plugin_item)) {
-    VlockPlugin *p = plugin_item->data;
-
-    for (GList *dependency_item = p->dependencies[CONFLICTS];
-         dependency_item != NULL;
-         dependency_item = g_list_next(dependency_item)) {
-      const char *d = dependency_item->data;
-      if (get_plugin(d) != NULL) {
-        g_set_error(
-          error,
-          VLOCK_PLUGIN_ERROR,
-          VLOCK_PLUGIN_ERROR_DEPENDENCY,
-          "'%s' and '%s' cannot be loaded at the same time",
-          p->name,
-          d);
-        errno = 0;
-        return false;
-      }
-    }
+  for (size_t i = 0; i < plugins->len; i++) {
+    VlockPlugin *p = g_ptr_array_index(plugins, i);
+    g_hash_table_insert(plugin_table, (gpointer) g_intern_string(p->name), p);
   }
 
-  return true;
+  return result;
 }
 
 static GList *get_edges(void);
@@ -316,25 +501,38 @@ static GList *get_edges(void);
 * dependencies.  Fails if sorting is not possible because of circles. */
 static bool sort_plugins(GError **error)
 {
-  GList *edges = get_edges();
+  GList *nodes = NULL;
+  GList *edges;
   GList *sorted_plugins;
 
+  if (plugins == NULL)
+    return true;
+
+  for (size_t i = plugins->len; i > 0; i--)
+    nodes = g_list_prepend(nodes, g_ptr_array_index(plugins, i-1));
+
+  edges = get_edges();
+
   /* Topological sort. */
-  sorted_plugins = tsort(plugins, &edges);
+  sorted_plugins = tsort(nodes, &edges);
+
+  g_list_free(nodes);
 
   bool tsort_successful = (edges == NULL);
 
   if (tsort_successful) {
-    /* Switch the global list of plugins for the sorted list.  The global list
-     * is static and cannot be freed. */
-
+    /* Replace the contents of the list of plugins with the sorted list. */
     g_assert(edges == NULL);
-    g_assert(g_list_length(sorted_plugins) == g_list_length(plugins));
+    g_assert(g_list_length(sorted_plugins) == plugins->len);
+
+    size_t i = 0;
 
-    GList *tmp = plugins;
-    plugins = sorted_plugins;
+    while (sorted_plugins != NULL) {
+      g_ptr_array_index(plugins, i++) = sorted_plugins->data;
+      sorted_plugins = g_list_delete_link(sorted_plugins, sorted_plugins);
+    }
 
-    g_list_free(tmp);
+    assign_levels();
 
     return true;
   } else {
@@ -370,10 +568,8 @@ static GList *get_edges(void)
 {
   GList *edges = NULL;
 
-  for (GList *plugin_item = plugins;
-       plugin_item != NULL;
-       plugin_item = g_list_next(plugin_item)) {
-    VlockPlugin *p = plugin_item->data;
+  for (size_t i = 0; i < plugins->len; i++) {
+    VlockPlugin *p = g_ptr_array_index(plugins, i);
     /* p must come after these */
     for (GList *predecessor_item = p->dependencies[SUCCEEDS];
          predecessor_item != NULL;
@@ -381,7 +577,7 @@ static GList *get_edges(void)
       VlockPlugin *q = get_plugin(predecessor_item->data);
 
       if (q != NULL)
-        edges = g_list_append(edges, make_edge(q, p));
+        edges = g_list_prepend(edges, make_edge(q, p));
     }
 
     /* p must come before these */
@@ -391,92 +587,416 @@ static GList *get_edges(void)
       VlockPlugin *q = get_plugin(successor_item->data);
 
       if (q != NULL)
-        edges = g_list_append(edges, make_edge(p, q));
+        edges = g_list_prepend(edges, make_edge(p, q));
     }
   }
 
-  return edges;
+  return g_list_reverse(edges);
+}
+
+/* Assign each plugin the lowest level that is higher than the levels of all
+ * plugins it must come after.  Then reorder the sorted list of plugins by
+ * level which is still a valid order. */
+static void assign_levels(void)
+{
+  unsigned int nr_levels = 0;
+  size_t *first;
+  VlockPlugin **sorted;
+
+  for (size_t i = 0; i < plugins->len; i++)
+    VLOCK_PLUGIN(g_ptr_array_index(plugins, i))->level = 0;
+
+  /* Plugins that p must come after are sorted before it so their levels are
+   * final when p is reached.  p pushes its level to the plugins it must come
+   * before. */
+  for (size_t i = 0; i < plugins->len; i++) {
+    VlockPlugin *p = g_ptr_array_index(plugins, i);
+
+    for (GList *item = p->dependencies[SUCCEEDS];
+         item != NULL;
+         item = g_list_next(item)) {
+      VlockPlugin *q = get_plugin(item->data);
+
+      if (q != NULL)
+        p->level = MAX(p->level, q->level + 1);
+    }
+
+    for (GList *item = p->dependencies[PRECEEDS];
+         item != NULL;
+         item = g_list_next(item)) {
+      VlockPlugin *q = get_plugin(item->data);
+
+      if (q != NULL)
+        q->level = MAX(q->level, p->level + 1);
+    }
+
+    nr_levels = MAX(nr_levels, p->level + 1);
+  }
+
+  /* Stable counting sort by level. */
+  first = g_new0(size_t, nr_levels + 1);
+  sorted = g_new(VlockPlugin *, plugins->len);
+
+  for (size_t i = 0; i < plugins->len; i++)
+    first[VLOCK_PLUGIN(g_ptr_array_index(plugins, i))->level + 1]++;
+
+  for (unsigned int l = 0; l < nr_levels; l++)
+    first[l + 1] += first[l];
+
+  for (size_t i = 0; i < plugins->len; i++) {
+    VlockPlugin *p = g_ptr_array_index(plugins, i);
+    sorted[first[p->level]++] = p;
+  }
+
+  for (size_t i = 0; i < plugins->len; i++)
+    g_ptr_array_index(plugins, i) = sorted[i];
+
+  g_free(sorted);
+  g_free(first);
+}
+
+/* Build the dispatch vector of each hook from the sorted list of plugins. */
+static void build_dispatch_vectors(void)
+{
+  for (size_t h = 0; h < nr_hooks; h++) {
+    if (dispatch[h] != NULL)
+      g_array_free(dispatch[h], true);
+
+    dispatch[h] = g_array_new(false, false, sizeof (struct dispatch_entry));
+
+    for (size_t i = 0; plugins != NULL && i < plugins->len; i++) {
+      VlockPlugin *p = g_ptr_array_index(plugins, i);
+      struct dispatch_entry entry;
+
+      if (!p->has_hook[h])
+        continue;
+
+      entry.plugin = p;
+      entry.call_hook = VLOCK_PLUGIN_GET_CLASS(p)->call_hook;
+      entry.post_hook = VLOCK_PLUGIN_GET_CLASS(p)->post_hook;
+      entry.complete_hook = VLOCK_PLUGIN_GET_CLASS(p)->complete_hook;
+      entry.get_hook_fd = VLOCK_PLUGIN_GET_CLASS(p)->get_hook_fd;
+      entry.position = i;
+
+      g_array_append_val(dispatch[h], entry);
+    }
+  }
 }
 
 /************/
 /* handlers */
 /************/
 
+/* Get the dispatch vector of the given hook.  Returns NULL if it is empty. */
+static inline GArray *get_dispatch_vector(size_t hook)
+{
+  if (dispatch[hook] == NULL || dispatch[hook]->len == 0)
+    return NULL;
+
+  return dispatch[hook];
+}
+
+#define dispatch_entry_at(vector, i) \
+  (&g_array_index((vector), struct dispatch_entry, (i)))
+
+/* Get the end of the level that starts at the given index of the dispatch
+ * vector. */
+static size_t level_end(GArray *vector, size_t first)
+{
+  unsigned int level = dispatch_entry_at(vector, first)->plugin->level;
+  size_t last = first + 1;
+
+  while (last < vector->len &&
+         dispatch_entry_at(vector, last)->plugin->level == level)
+    last++;
+
+  return last;
+}
+
+/* A single call of a hook. */
+struct hook_call
+{
+  struct dispatch_entry *entry;
+  size_t hook;
+  bool result;
+  /* The value of errno after the call. */
+  int errsv;
+};
+
+/* Wait until the results of all successfully posted hooks may be available or
+ * the deadline passes.  The descriptors of all plugins are polled together so
+ * that plugins that do not answer cost no more than a single timeout. */
+static void wait_for_posted_hooks(struct hook_call *calls,
+                                  size_t nr_calls,
+                                  gint64 deadline)
+{
+  struct pollfd *pfds = g_new(struct pollfd, nr_calls);
+  nfds_t nr_pending = 0;
+
+  for (size_t i = 0; i < nr_calls; i++) {
+    struct dispatch_entry *e = calls[i].entry;
+    int fd;
+
+    if (e->post_hook == NULL || !calls[i].result || e->get_hook_fd == NULL)
+      continue;
+
+    fd = e->get_hook_fd(e->plugin);
+
+    if (fd < 0)
+      continue;
+
+    pfds[nr_pending].fd = fd;
+    pfds[nr_pending].events = POLLIN;
+    pfds[nr_pending].revents = 0;
+    nr_pending++;
+  }
+
+  while (nr_pending > 0) {
+    /* Round up to whole milliseconds. */
+    gint64 timeout = (deadline - g_get_monotonic_time() + 999) / 1000;
+    nfds_t remaining = 0;
+    int result;
+
+    if (timeout <= 0)
+      break;
+
+    result = poll(pfds, nr_pending, timeout);
+
+    if (result < 0 && errno == EINTR)
+      continue;
+
+    if (result <= 0)
+      break;
+
+    /* Stop watching the descriptors that have something to say. */
+    for (nfds_t i = 0; i < nr_pending; i++)
+      if (pfds[i].revents == 0)
+        pfds[remaining++] = pfds[i];
+
+    nr_pending = remaining;
+  }
+
+  g_free(pfds);
+}
+
+/* Call the hook of the plugins from the given level of the dispatch vector
+ * together.  If skip_save_disabled is set plugins whose "vlock_save" hook is
+ * disabled are skipped.  Returns the number of calls stored in calls.
+ *
+ * The hook is first posted to all plugins that support it, i.e. scripts, so
+ * that they run while the hooks of the other plugins, i.e. modules, are
+ * called one after another.  Modules are not thread-safe and may drive the
+ * same console, so they are never called concurrently.  Finally the results
+ * of the posted hooks are collected against a single deadline that starts
+ * when the modules are done. */
+static size_t call_level(GArray *vector,
+                         size_t first,
+                         size_t hook,
+                         bool skip_save_disabled,
+                         struct hook_call *calls)
+{
+  size_t last = level_end(vector, first);
+  size_t nr_calls = 0;
+  gint64 deadline;
+
+  for (size_t i = first; i < last; i++) {
+    struct dispatch_entry *e = dispatch_entry_at(vector, i);
+
+    if (skip_save_disabled && e->plugin->save_disabled)
+      continue;
+
+    calls[nr_calls].entry = e;
+    calls[nr_calls].hook = hook;
+    calls[nr_calls].result = false;
+    calls[nr_calls].errsv = 0;
+
+    nr_calls++;
+  }
+
+  for (size_t i = 0; i < nr_calls; i++) {
+    struct hook_call *call = &calls[i];
+
+    if (call->entry->post_hook != NULL) {
+      errno = 0;
+      call->result = call->entry->post_hook(call->entry->plugin, hook);
+      call->errsv = errno;
+    }
+  }
+
+  for (size_t i = 0; i < nr_calls; i++) {
+    struct hook_call *call = &calls[i];
+
+    if (call->entry->post_hook != NULL)
+      continue;
+
+    errno = 0;
+    call->result = call->entry->call_hook(call->entry->plugin, hook);
+    call->errsv = errno;
+  }
+
+  /* The scripts get the full timeout after the modules are done, however long
+   * these took. */
+  deadline = g_get_monotonic_time() + HOOK_ACK_TIMEOUT_USEC;
+
+  wait_for_posted_hooks(calls, nr_calls, deadline);
+
+  for (size_t i = 0; i < nr_calls; i++) {
+    struct hook_call *call = &calls[i];
+
+    if (call->entry->post_hook != NULL && call->result) {
+      errno = 0;
+      call->result = call->entry->complete_hook(call->entry->plugin, hook,
+                                                deadline);
+      call->errsv = errno;
+    }
+  }
+
+  return nr_calls;
+}
+
 /* Call the "vlock_start" hook of each plugin.  Fails if the hook of one of the
  * plugins fails.  In this case the "vlock_end" hooks of all plugins that were
- * called before are called in reverse order. */
-void handle_vlock_start(const char *hook_name)
-{
-  for (GList *plugin_item = plugins;
-       plugin_item != NULL;
-       plugin_item = g_list_next(plugin_item)) {
-    VlockPlugin *p = plugin_item->data;
-
-    if (!vlock_plugin_call_hook(p, hook_name)) {
-      int errsv = errno;
-
-      for (GList *reverse_item = g_list_previous(plugin_item);
-           reverse_item != NULL;
-           reverse_item = g_list_previous(reverse_item)) {
-        VlockPlugin *r = reverse_item->data;
-        (void) vlock_plugin_call_hook(r, "vlock_end");
+ * started before or together with the failed plugins and did not fail
+ * themselves are called in reverse order. */
+void handle_vlock_start(void)
+{
+  GArray *start = get_dispatch_vector(HOOK_VLOCK_START);
+  struct hook_call *calls;
+
+  if (start == NULL)
+    return;
+
+  calls = g_new(struct hook_call, start->len);
+
+  for (size_t first = 0; first < start->len; first = level_end(start, first)) {
+    size_t nr_calls = call_level(start, first, HOOK_VLOCK_START, false, calls);
+    unsigned int level = dispatch_entry_at(start, first)->plugin->level;
+    struct hook_call *failed_call = NULL;
+    bool *failed = g_new0(bool, plugins->len);
+    GArray *end;
+
+    for (size_t i = nr_calls; i > 0; i--)
+      if (!calls[i-1].result) {
+        failed[calls[i-1].entry->position] = true;
+        failed_call = &calls[i-1];
       }
 
-      if (errsv)
-        fprintf(stderr, "vlock: plugin '%s' failed: %s\n", p->name,
-                strerror(errsv));
+    if (failed_call == NULL) {
+      g_free(failed);
+      continue;
+    }
+
+    end = get_dispatch_vector(HOOK_VLOCK_END);
 
-      exit(EXIT_FAILURE);
+    for (size_t j = (end != NULL) ? end->len : 0; j > 0; j--) {
+      struct dispatch_entry *r = dispatch_entry_at(end, j-1);
+
+      if (r->plugin->level < level ||
+          (r->plugin->level == level && !failed[r->position]))
+        (void) r->call_hook(r->plugin, HOOK_VLOCK_END);
     }
+
+    if (failed_call->errsv)
+      fprintf(stderr, "vlock: plugin '%s' failed: %s\n",
+              failed_call->entry->plugin->name,
+              strerror(failed_call->errsv));
+
+    exit(EXIT_FAILURE);
   }
+
+  g_free(calls);
 }
 
 /* Call the "vlock_end" hook of each plugin in reverse order.  Never fails. */
-void handle_vlock_end(const char *hook_name)
+void handle_vlock_end(void)
 {
-  for (GList *plugin_item = g_list_last(plugins);
-       plugin_item != NULL;
-       plugin_item = g_list_previous(plugin_item)) {
-    VlockPlugin *p = plugin_item->data;
-    (void) vlock_plugin_call_hook(p, hook_name);
+  GArray *end = get_dispatch_vector(HOOK_VLOCK_END);
+  struct hook_call *calls;
+
+  if (end == NULL)
+    return;
+
+  calls = g_new(struct hook_call, end->len);
+
+  /* Find the first entry of each level going backwards. */
+  for (size_t last = end->len; last > 0;) {
+    size_t first = last - 1;
+    unsigned int level = dispatch_entry_at(end, first)->plugin->level;
+
+    while (first > 0 && dispatch_entry_at(end, first-1)->plugin->level == level)
+      first--;
+
+    (void) call_level(end, first, HOOK_VLOCK_END, false, calls);
+
+    last = first;
   }
+
+  g_free(calls);
 }
 
 /* Call the "vlock_save" hook of each plugin.  Never fails.  If the hook of a
  * plugin fails its "vlock_save_abort" hook is called and both hooks are never
  * called again afterwards. */
-void handle_vlock_save(const char *hook_name)
+void handle_vlock_save(void)
 {
-  for (GList *plugin_item = plugins;
-       plugin_item != NULL;
-       plugin_item = g_list_next(plugin_item)) {
-    VlockPlugin *p = plugin_item->data;
+  GArray *save = get_dispatch_vector(HOOK_VLOCK_SAVE);
+  struct hook_call *calls;
 
-    if (p->save_disabled)
-      continue;
+  if (save == NULL)
+    return;
+
+  calls = g_new(struct hook_call, save->len);
+
+  for (size_t first = 0; first < save->len; first = level_end(save, first)) {
+    size_t nr_calls = call_level(save, first, HOOK_VLOCK_SAVE, true, calls);
+
+    for (size_t i = 0; i < nr_calls; i++) {
+      struct dispatch_entry *e = calls[i].entry;
 
-    if (!vlock_plugin_call_hook(p, hook_name)) {
-      p->save_disabled = true;
-      (void) vlock_plugin_call_hook(p, "vlock_save_abort");
+      if (calls[i].result)
+        continue;
+
+      e->plugin->save_disabled = true;
+
+      if (e->plugin->has_hook[HOOK_VLOCK_SAVE_ABORT])
+        (void) e->call_hook(e->plugin, HOOK_VLOCK_SAVE_ABORT);
     }
   }
+
+  g_free(calls);
 }
 
-/* Call the "vlock_save" hook of each plugin.  Never fails.  If the hook of a
- * plugin fails both hooks "vlock_save" and "vlock_save_abort" are never called
- * again afterwards. */
-void handle_vlock_save_abort(const char *hook_name)
+/* Call the "vlock_save_abort" hook of each plugin in reverse order.  Never
+ * fails.  If the hook of a plugin fails both hooks "vlock_save" and
+ * "vlock_save_abort" are never called again afterwards. */
+void handle_vlock_save_abort(void)
 {
-  for (GList *plugin_item = g_list_last(plugins);
-       plugin_item != NULL;
-       plugin_item = g_list_previous(plugin_item)) {
-    VlockPlugin *p = plugin_item->data;
+  GArray *save_abort = get_dispatch_vector(HOOK_VLOCK_SAVE_ABORT);
+  struct hook_call *calls;
 
-    if (p->save_disabled)
-      continue;
+  if (save_abort == NULL)
+    return;
+
+  calls = g_new(struct hook_call, save_abort->len);
+
+  for (size_t last = save_abort->len; last > 0;) {
+    size_t first = last - 1;
+    unsigned int level = dispatch_entry_at(save_abort, first)->plugin->level;
+    size_t nr_calls;
+
+    while (first > 0 &&
+           dispatch_entry_at(save_abort, first-1)->plugin->level == level)
+      first--;
 
-    if (!vlock_plugin_call_hook(p, hook_name))
-      p->save_disabled = true;
+    nr_calls = call_level(save_abort, first, HOOK_VLOCK_SAVE_ABORT, true,
+                          calls);
+
+    for (size_t i = 0; i < nr_calls; i++)
+      if (!calls[i].result)
+        calls[i].entry->plugin->save_disabled = true;
+
+    last = first;
   }
-}
 
+  g_free(calls);
+}
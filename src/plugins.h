@@ -19,12 +19,41 @@
 /* Load the named plugin. */
 bool load_plugin(const char *name, GError **error);
 
+/* Load the named plugins at once.  This is faster than loading them one by one
+ * because scripts are probed concurrently.  Errors are not reported here but
+ * by the following calls to load_plugin() with the same names. */
+void preload_plugins(char *const names[], size_t nr_names);
+
 /* Resolve all the dependencies between all plugins.  This function *must* be
  * called after all plugins were loaded.  */
 bool resolve_dependencies(GError **error);
 
+/* Activate all plugins that remain after resolving the dependencies.  This
+ * function *must* be called before the first hook is called. */
+bool activate_plugins(GError **error);
+
+/* Remember all plugins that are opened from now on.  This must be called
+ * before loading the plugins if a plan is written afterwards. */
+void record_opened_plugins(void);
+
+/* Write a plan of the plugins after their dependencies were resolved.  The
+ * names must be those the plugins were loaded with.  See plan.h. */
+bool write_plan(const char *path,
+                char *const names[],
+                size_t nr_names,
+                GError **error);
+
+/* Load the plugins from a plan written for the given names.  This replaces
+ * loading the plugins and resolving their dependencies.  Fails if the plan is
+ * invalid or out of date. */
+bool load_plan(const char *path,
+               char *const names[],
+               size_t nr_names,
+               GError **error);
+
 /* Unload all plugins. */
 void unload_plugins(void);
 
-/* Call the given plugin hook. */
-void plugin_hook(const char *hook_name);
+/* Call the given plugin hook.  The hook is one of the HOOK_* constants from
+ * plugin.h. */
+void plugin_hook(size_t hook);
@@ -11,7 +11,13 @@
  *
  */
 
+#if !defined(__FreeBSD__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
 #include <unistd.h>
 #include <signal.h>
 #include <sys/wait.h>
@@ -19,8 +25,17 @@
 #include <sys/time.h>
 #include <fcntl.h>
 #include <sys/select.h>
+#include <poll.h>
 #include <errno.h>
 
+#ifdef __linux__
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#endif
+
 #include "process.h"
 
 GQuark vlock_process_error_quark(void)
@@ -28,14 +43,287 @@ GQuark vlock_process_error_quark(void)
   return g_quark_from_static_string("vlock-process-error-quark");
 }
 
+/* The supervisor keeps a record of every child created by create_child().
+ * Children are reaped by whoever notices their death first: the functions
+ * that wait for children or reap_children() which is called when SIGCHLD
+ * arrives on the signal file descriptor.  The exit status stays available
+ * afterwards. */
+
+/* A crashed child is restarted at most this many times. */
+#define MAX_RESTARTS 3
+
+struct supervised_child
+{
+  pid_t pid;
+  gchar *name;
+  /* The child to restart if it crashes or NULL. */
+  struct child_process *restart;
+  /* How often the child was restarted before. */
+  unsigned int restarts;
+  /* Set when vlock sends the child a signal. */
+  bool killed;
+  bool exited;
+  int status;
+  struct rusage rusage;
+};
+
+/* Children are only created, reaped and waited for by the thread running the
+ * event loop, including plugin hooks, which are no longer called from threads.
+ * Authentication workers never touch them.  The lock is cheap and keeps the
+ * table consistent should a worker ever need a child. */
+G_LOCK_DEFINE_STATIC(children);
+
+/* The records of all children by PID. */
+static GHashTable *children = NULL;
+
+/* The signal file descriptor for SIGCHLD. */
+static int supervisor_fd = -1;
+
+static void free_supervised_child(gpointer data)
+{
+  struct supervised_child *c = data;
+
+  g_free(c->name);
+  g_free(c);
+}
+
+/* Must be called with the lock held. */
+static struct supervised_child *lookup_child(pid_t pid)
+{
+  if (children == NULL)
+    return NULL;
+
+  return g_hash_table_lookup(children, GINT_TO_POINTER(pid));
+}
+
+/* Add a record for the given freshly created child. */
+static void supervise_child(struct child_process *child, bool restartable)
+{
+  struct supervised_child *c = g_new0(struct supervised_child, 1);
+
+  c->pid = child->pid;
+  c->name = g_strdup(child->name != NULL ? child->name : "unknown");
+  c->restart = (child->restart && restartable) ? child : NULL;
+
+  G_LOCK(children);
+
+  if (children == NULL)
+    children = g_hash_table_new_full(NULL, NULL, NULL, free_supervised_child);
+
+  /* The record of a dead child whose PID was reused is replaced. */
+  g_hash_table_replace(children, GINT_TO_POINTER(c->pid), c);
+
+  G_UNLOCK(children);
+}
+
+/* Record the exit status of a child.  Must be called with the lock held. */
+static void record_exit(struct supervised_child *c,
+                        int status,
+                        const struct rusage *rusage)
+{
+  c->exited = true;
+  c->status = status;
+  c->rusage = *rusage;
+
+  if (WIFSIGNALED(status))
+    g_debug("child %d of %s was killed by signal %d", (int) c->pid, c->name,
+            WTERMSIG(status));
+  else
+    g_debug("child %d of %s exited with status %d", (int) c->pid, c->name,
+            WEXITSTATUS(status));
+
+  g_debug("child %d of %s used %ld.%06lds user and %ld.%06lds system time",
+          (int) c->pid, c->name,
+          (long) rusage->ru_utime.tv_sec, (long) rusage->ru_utime.tv_usec,
+          (long) rusage->ru_stime.tv_sec, (long) rusage->ru_stime.tv_usec);
+}
+
+/* Reap the given child like waitpid() and record its exit status.  A child
+ * that was reaped before by the supervisor counts as dead. */
+static pid_t reap_child(pid_t pid, int options)
+{
+  struct supervised_child *c;
+  struct rusage rusage;
+  int status;
+  pid_t result = wait4(pid, &status, options, &rusage);
+  int errsv = errno;
+
+  G_LOCK(children);
+
+  c = lookup_child(pid);
+
+  if (result == pid && c != NULL)
+    record_exit(c, status, &rusage);
+  else if (result < 0 && errsv == ECHILD && c != NULL && c->exited)
+    result = pid;
+
+  G_UNLOCK(children);
+
+  errno = errsv;
+  return result;
+}
+
+/* Prevent the given child from being restarted because vlock kills it. */
+static void mark_killed(pid_t pid)
+{
+  struct supervised_child *c;
+
+  G_LOCK(children);
+
+  c = lookup_child(pid);
+
+  if (c != NULL)
+    c->killed = true;
+
+  G_UNLOCK(children);
+}
+
+void start_supervisor(void)
+{
+#ifdef __linux__
+  sigset_t mask;
+
+  if (supervisor_fd >= 0)
+    return;
+
+  (void) sigemptyset(&mask);
+  (void) sigaddset(&mask, SIGCHLD);
+
+  /* The signal must be blocked to be delivered through the descriptor. */
+  if (pthread_sigmask(SIG_BLOCK, &mask, NULL) != 0)
+    return;
+
+  supervisor_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+
+  if (supervisor_fd < 0)
+    (void) pthread_sigmask(SIG_UNBLOCK, &mask, NULL);
+#endif
+}
+
+int get_supervisor_fd(void)
+{
+  return supervisor_fd;
+}
+
+/* A child that crashed and should be restarted. */
+struct crashed_child
+{
+  struct child_process *child;
+  unsigned int restarts;
+};
+
+void reap_children(void)
+{
+  GArray *crashed = g_array_new(false, false, sizeof (struct crashed_child));
+
+#ifdef __linux__
+  if (supervisor_fd >= 0) {
+    struct signalfd_siginfo info;
+
+    /* Pending signals are merged so the children are checked one by one
+     * below anyway. */
+    while (read(supervisor_fd, &info, sizeof info) == sizeof info)
+      continue;
+  }
+#endif
+
+  G_LOCK(children);
+
+  if (children != NULL) {
+    GHashTableIter iter;
+    gpointer value;
+
+    g_hash_table_iter_init(&iter, children);
+
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+      struct supervised_child *c = value;
+      struct rusage rusage;
+      int status;
+
+      if (c->exited || wait4(c->pid, &status, WNOHANG, &rusage) != c->pid)
+        continue;
+
+      record_exit(c, status, &rusage);
+
+      if (c->restart != NULL && !c->killed && WIFSIGNALED(status)) {
+        struct crashed_child crash = {
+          .child = c->restart,
+          .restarts = c->restarts,
+        };
+
+        g_array_append_val(crashed, crash);
+      }
+
+      c->restart = NULL;
+    }
+  }
+
+  G_UNLOCK(children);
+
+  /* Creating children takes the lock. */
+  for (size_t i = 0; i < crashed->len; i++) {
+    struct crashed_child *crash = &g_array_index(crashed, struct crashed_child,
+                                                 i);
+    GError *err = NULL;
+
+    if (crash->restarts >= MAX_RESTARTS) {
+      g_warning("not restarting child of %s again",
+                crash->child->name != NULL ? crash->child->name : "unknown");
+      continue;
+    }
+
+    if (create_child(crash->child, &err)) {
+      struct supervised_child *c;
+
+      G_LOCK(children);
+
+      c = lookup_child(crash->child->pid);
+
+      if (c != NULL)
+        c->restarts = crash->restarts + 1;
+
+      G_UNLOCK(children);
+    } else {
+      g_warning("could not restart child of %s: %s",
+                crash->child->name != NULL ? crash->child->name : "unknown",
+                err->message);
+      g_clear_error(&err);
+    }
+  }
+
+  g_array_free(crashed, true);
+}
+
+bool get_child_status(pid_t pid, int *status, struct rusage *rusage)
+{
+  struct supervised_child *c;
+  bool exited;
+
+  G_LOCK(children);
+
+  c = lookup_child(pid);
+  exited = (c != NULL && c->exited);
+
+  if (exited && status != NULL)
+    *status = c->status;
+
+  if (exited && rusage != NULL)
+    *rusage = c->rusage;
+
+  G_UNLOCK(children);
+
+  return exited;
+}
+
 /* Do nothing. */
 static void ignore_sigalarm(int __attribute__((unused)) signum)
 {
 }
 
-bool wait_for_death(pid_t pid, long sec, long usec)
+/* Wait for the death of a single child process by interrupting waitpid() with
+ * SIGALRM.  Used if the kernel does not support process file descriptors. */
+static bool wait_for_death_alarm(pid_t pid, long sec, long usec)
 {
-  int status;
   struct sigaction act;
   struct sigaction oldact;
   struct itimerval timer;
@@ -63,7 +351,7 @@ bool wait_for_death(pid_t pid, long sec, long usec)
   setitimer(ITIMER_REAL, &timer, &otimer);
 
   /* Wait until the child exits or the timer fires. */
-  result = (waitpid(pid, &status, 0) == pid);
+  result = (reap_child(pid, 0) == pid);
 
   /* Possible race condition.  If an alarm was set before it may get ignored.
    * This is probably better than getting killed by our own alarm. */
@@ -77,37 +365,304 @@ bool wait_for_death(pid_t pid, long sec, long usec)
   return result;
 }
 
+/* Open a file descriptor that becomes readable when the given process
+ * exits. */
+static int open_pidfd(pid_t pid)
+{
+#if defined(__linux__) && defined(SYS_pidfd_open)
+  return syscall(SYS_pidfd_open, pid, 0);
+#else
+  (void) pid;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+/* Reap the given child process if it is dead. */
+static bool reap(pid_t pid)
+{
+  return reap_child(pid, WNOHANG) == pid;
+}
+
+/* Get the timeout for poll() in milliseconds until the given deadline, rounded
+ * up.  A negative deadline means no timeout. */
+static int poll_timeout(gint64 deadline)
+{
+  gint64 timeout;
+
+  if (deadline < 0)
+    return -1;
+
+  timeout = (deadline - g_get_monotonic_time() + 999) / 1000;
+
+  if (timeout <= 0)
+    return 0;
+
+  return (timeout < INT_MAX) ? (int) timeout : INT_MAX;
+}
+
+/* Wait for the given children one after the other with SIGALRM until the
+ * deadline. */
+static void wait_for_deaths_alarm(const pid_t pids[],
+                                  bool dead[],
+                                  size_t nr_pids,
+                                  gint64 deadline)
+{
+  for (size_t i = 0; i < nr_pids; i++) {
+    gint64 remaining;
+
+    if (dead[i])
+      continue;
+
+    if (deadline < 0) {
+      dead[i] = wait_for_death_alarm(pids[i], 0, 0);
+      continue;
+    }
+
+    remaining = deadline - g_get_monotonic_time();
+
+    if (remaining > 0)
+      dead[i] = wait_for_death_alarm(pids[i], remaining / 1000000,
+                                     remaining % 1000000);
+    else
+      dead[i] = reap(pids[i]);
+  }
+}
+
+bool wait_for_deaths(const pid_t pids[], bool dead[], size_t nr_pids,
+                     long sec, long usec)
+{
+  gint64 deadline = -1;
+  struct pollfd *fds = g_new(struct pollfd, nr_pids);
+  /* Maps entries of fds to children. */
+  size_t *fd_pids = g_new(size_t, nr_pids);
+  size_t nr_fds = 0;
+  size_t nr_open;
+  bool result = true;
+
+  if (sec != 0 || usec != 0)
+    deadline = g_get_monotonic_time() + (gint64) sec * 1000000 + usec;
+
+  for (size_t i = 0; i < nr_pids; i++) {
+    int fd;
+
+    if (dead[i] || (dead[i] = reap(pids[i])))
+      continue;
+
+    fd = open_pidfd(pids[i]);
+
+    if (fd < 0) {
+      /* Process file descriptors are not supported or the process does not
+       * exist.  In the latter case the fallback returns immediately. */
+      for (size_t j = 0; j < nr_fds; j++)
+        (void) close(fds[j].fd);
+
+      nr_fds = 0;
+      wait_for_deaths_alarm(pids, dead, nr_pids, deadline);
+      goto out;
+    }
+
+    fds[nr_fds].fd = fd;
+    fds[nr_fds].events = POLLIN;
+    fds[nr_fds].revents = 0;
+    fd_pids[nr_fds] = i;
+    nr_fds++;
+  }
+
+  for (nr_open = nr_fds; nr_open > 0;) {
+    int timeout = poll_timeout(deadline);
+    int ready = (timeout != 0) ? poll(fds, nr_fds, timeout) : 0;
+
+    if (ready < 0 && errno == EINTR)
+      continue;
+
+    if (ready <= 0)
+      break;
+
+    for (size_t j = 0; j < nr_fds; j++) {
+      if (fds[j].fd < 0 || fds[j].revents == 0)
+        continue;
+
+      dead[fd_pids[j]] = reap(pids[fd_pids[j]]);
+
+      /* Negative descriptors are ignored by poll(). */
+      (void) close(fds[j].fd);
+      fds[j].fd = -1;
+      nr_open--;
+    }
+  }
+
+  for (size_t j = 0; j < nr_fds; j++)
+    if (fds[j].fd >= 0) {
+      (void) close(fds[j].fd);
+      /* The child may have died after the last call to poll(). */
+      dead[fd_pids[j]] = reap(pids[fd_pids[j]]);
+    }
+
+out:
+  for (size_t i = 0; i < nr_pids; i++)
+    result = result && dead[i];
+
+  g_free(fd_pids);
+  g_free(fds);
+
+  return result;
+}
+
+bool wait_for_death(pid_t pid, long sec, long usec)
+{
+  bool dead = false;
+
+  return wait_for_deaths(&pid, &dead, 1, sec, usec);
+}
+
+void ensure_deaths(const pid_t pids[], size_t nr_pids)
+{
+  bool *dead = g_new(bool, nr_pids);
+
+  for (size_t i = 0; i < nr_pids; i++) {
+    mark_killed(pids[i]);
+    /* Children that are not yours or already dead need nothing to be done. */
+    dead[i] = (reap_child(pids[i], WNOHANG) != 0);
+  }
+
+  /* Send SIGTERM. */
+  for (size_t i = 0; i < nr_pids; i++)
+    if (!dead[i])
+      (void) kill(pids[i], SIGTERM);
+
+  /* SIGTERM handlers (if any) have 500ms to finish. */
+  if (!wait_for_deaths(pids, dead, nr_pids, 0, 500000L)) {
+    for (size_t i = 0; i < nr_pids; i++) {
+      if (dead[i])
+        continue;
+
+      /* Send SIGKILL. */
+      (void) kill(pids[i], SIGKILL);
+      /* Child may be stopped.  Send SIGCONT just to be sure. */
+      (void) kill(pids[i], SIGCONT);
+    }
+
+    /* Wait until dead.  Shouldn't take long. */
+    for (size_t i = 0; i < nr_pids; i++)
+      if (!dead[i])
+        (void) reap_child(pids[i], 0);
+  }
+
+  g_free(dead);
+}
+
 /* Try hard to kill the given child process. */
 void ensure_death(pid_t pid)
 {
-  int status;
+  ensure_deaths(&pid, 1);
+}
+
+/* The functions below run in the child between fork() and exec() and must
+ * only use async-signal-safe functions.  In particular they must not allocate
+ * memory. */
+
+/* Close all file descriptors from first to last except the ones in the given
+ * set using the close_range() system call.  Returns false if the kernel does
+ * not support it. */
+static bool close_range_except(int first, int last, fd_set *except_fds)
+{
+#ifdef SYS_close_range
+  int fd = first;
+
+  while (fd <= last) {
+    int range_end;
+
+    while (fd <= last && fd < FD_SETSIZE && FD_ISSET(fd, except_fds))
+      fd++;
+
+    if (fd > last)
+      break;
+
+    range_end = fd;
+
+    while (range_end < last && range_end + 1 < FD_SETSIZE &&
+           !FD_ISSET(range_end + 1, except_fds))
+      range_end++;
+
+    /* There are no exceptions beyond the set. */
+    if (range_end + 1 >= FD_SETSIZE)
+      range_end = last;
+
+    if (syscall(SYS_close_range, (unsigned int) fd, (unsigned int) range_end,
+                0U) < 0)
+      /* Only the first call can fail this way. */
+      return false;
 
-  switch (waitpid(pid, &status, WNOHANG)) {
-    case -1:
-      /* Not your child? */
-      return;
-    case 0:
-      /* Not dead yet.  Continue. */
+    if (range_end == last)
       break;
-    default:
-      /* Already dead.  Nothing to do. */
-      return;
+
+    fd = range_end + 1;
   }
 
-  /* Send SIGTERM. */
-  (void) kill(pid, SIGTERM);
+  return true;
+#else
+  (void) first;
+  (void) last;
+  (void) except_fds;
+  return false;
+#endif
+}
 
-  /* SIGTERM handler (if any) has 500ms to finish. */
-  if (wait_for_death(pid, 0, 500000L))
-    return;
+#if defined(__linux__) && defined(SYS_getdents64)
+struct linux_dirent64
+{
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+#endif
+
+/* Close all open file descriptors except the ones in the given set by
+ * enumerating /proc/self/fd.  The directory is read with the raw system call
+ * because opendir() allocates memory.  Returns false if /proc is not
+ * available. */
+static bool close_proc_fds(fd_set *except_fds)
+{
+#if defined(__linux__) && defined(SYS_getdents64)
+  char buffer[4096] __attribute__((aligned(8)));
+  int dir_fd = open("/proc/self/fd", O_RDONLY | O_DIRECTORY);
+  long length;
+
+  if (dir_fd < 0)
+    return false;
+
+  while ((length = syscall(SYS_getdents64, dir_fd, buffer, sizeof buffer)) > 0) {
+    for (long offset = 0; offset < length;) {
+      struct linux_dirent64 *entry = (struct linux_dirent64 *)(buffer + offset);
+      int fd = 0;
+      const char *c;
+
+      offset += entry->d_reclen;
+
+      /* Skip "." and "..". */
+      if (entry->d_name[0] < '0' || entry->d_name[0] > '9')
+        continue;
+
+      for (c = entry->d_name; *c >= '0' && *c <= '9'; c++)
+        fd = fd * 10 + (*c - '0');
+
+      if (fd == dir_fd || (fd < FD_SETSIZE && FD_ISSET(fd, except_fds)))
+        continue;
+
+      (void) close(fd);
+    }
+  }
 
-  // Send SIGKILL. */
-  (void) kill(pid, SIGKILL);
-  /* Child may be stopped.  Send SIGCONT just to be sure. */
-  (void) kill(pid, SIGCONT);
+  (void) close(dir_fd);
 
-  /* Wait until dead.  Shouldn't take long. */
-  (void) waitpid(pid, &status, 0);
+  return length == 0;
+#else
+  (void) except_fds;
+  return false;
+#endif
 }
 
 /* Close all possibly open file descriptors except the ones specified in the
@@ -118,16 +673,25 @@ static void close_fds(fd_set *except_fds)
   int maxfd;
 
   /* Get the maximum number of file descriptors. */
-  if (getrlimit(RLIMIT_NOFILE, &r) == 0)
-    maxfd = r.rlim_cur;
+  if (getrlimit(RLIMIT_NOFILE, &r) == 0 && r.rlim_cur != RLIM_INFINITY)
+    maxfd = (r.rlim_cur < INT32_MAX) ? (int) r.rlim_cur : INT32_MAX;
   else
     /* Hopefully safe default. */
     maxfd = 1024;
 
+  /* Let the kernel do it if it can.  This also closes descriptors above the
+   * limit. */
+  if (close_range_except(0, INT_MAX, except_fds))
+    return;
+
+  /* Otherwise only look at the descriptors that are actually open. */
+  if (close_proc_fds(except_fds))
+    return;
+
   /* Close all possibly open file descriptors except STDIN_FILENO,
    * STDOUT_FILENO and STDERR_FILENO. */
   for (int fd = 0; fd < maxfd; fd++)
-    if (!FD_ISSET(fd, except_fds))
+    if (fd >= FD_SETSIZE || !FD_ISSET(fd, except_fds))
       (void) close(fd);
 }
 
@@ -141,21 +705,183 @@ static int open_devnull(void)
   return devnull_fd;
 }
 
-bool create_child(struct child_process *child, GError **error)
+/* Everything the child needs to set itself up. */
+struct child_context
 {
-  int child_errno = 0;
-  int status_pipe[2];
+  struct child_process *child;
   int stdin_pipe[2];
   int stdout_pipe[2];
   int stderr_pipe[2];
+  /* The write end of the pipe the child reports exec errors through. */
+  int status_fd;
+  /* The signal mask of the parent before all signals were blocked. */
+  sigset_t signal_mask;
+};
+
+/* Redirect a standard descriptor of the child. */
+static void redirect_fd(int redirect, int pipe_fd, int target_fd)
+{
+  if (redirect == REDIRECT_PIPE)
+    (void) dup2(pipe_fd, target_fd);
+  else if (redirect == REDIRECT_DEV_NULL)
+    (void) dup2(open_devnull(), target_fd);
+  else if (redirect != NO_REDIRECT)
+    (void) dup2(redirect, target_fd);
+}
+
+/* Drop the privileges of the child.  On Linux the system calls are made
+ * directly because the libc wrappers also change the credentials of all other
+ * threads.  A child that shares the memory of the parent would change those of
+ * the parent's threads. */
+static void drop_privileges(void)
+{
+  gid_t gid = getgid();
+  uid_t uid = getuid();
+
+#if defined(SYS_setresgid32) && defined(SYS_setresuid32)
+  (void) syscall(SYS_setresgid32, gid, gid, gid);
+  (void) syscall(SYS_setresuid32, uid, uid, uid);
+#elif defined(SYS_setresgid) && defined(SYS_setresuid)
+  (void) syscall(SYS_setresgid, gid, gid, gid);
+  (void) syscall(SYS_setresuid, uid, uid, uid);
+#else
+  (void) setgid(gid);
+  (void) setuid(uid);
+#endif
+}
+
+/* Set up the standard descriptors of the child, close all others and drop
+ * privileges.  Runs in the child. */
+static void setup_child(struct child_context *context)
+{
+  struct child_process *child = context->child;
+  sigset_t signal_mask;
+  fd_set except_fds;
+
+  redirect_fd(child->stdin_fd, context->stdin_pipe[0], STDIN_FILENO);
+  redirect_fd(child->stdout_fd, context->stdout_pipe[1], STDOUT_FILENO);
+  redirect_fd(child->stderr_fd, context->stderr_pipe[1], STDERR_FILENO);
+
+  /* The supervisor and the event loop block the signals they read from file
+   * descriptors. */
+  (void) sigemptyset(&signal_mask);
+  (void) sigprocmask(SIG_SETMASK, &signal_mask, NULL);
+
+  FD_ZERO(&except_fds);
+  FD_SET(STDIN_FILENO, &except_fds);
+  FD_SET(STDOUT_FILENO, &except_fds);
+  FD_SET(STDERR_FILENO, &except_fds);
+  FD_SET(context->status_fd, &except_fds);
+
+  (void) close_fds(&except_fds);
+
+  drop_privileges();
+}
+
+/* Set up the child and execute the program.  Returns only if that fails. */
+static int exec_child(void *argument)
+{
+  struct child_context *context = argument;
+
+  setup_child(context);
+
+  execv(context->child->path, (char *const*) context->child->argv);
+  (void) write(context->status_fd, &errno, sizeof errno);
+
+  return 1;
+}
+
+#ifdef __linux__
+/* The size of the stack of children that share the memory of the parent. */
+#define CLONE_STACK_SIZE (64 * 1024)
+
+/* Run in a child that shares the memory of the parent.  Signal handlers of
+ * the parent must not run here so they are reset before the signals that
+ * were blocked by the parent are unblocked again. */
+static int clone_child(void *argument)
+{
+  struct child_context *context = argument;
+
+  for (int signum = 1; signum < NSIG; signum++) {
+    struct sigaction act;
+
+    if (sigaction(signum, NULL, &act) == 0 &&
+        act.sa_handler != SIG_IGN && act.sa_handler != SIG_DFL) {
+      act.sa_handler = SIG_DFL;
+      act.sa_flags = 0;
+      (void) sigaction(signum, &act, NULL);
+    }
+  }
+
+  (void) sigprocmask(SIG_SETMASK, &context->signal_mask, NULL);
+
+  return exec_child(context);
+}
+
+/* Start a child that executes a program without copying the page tables of
+ * the parent.  The parent is suspended until the child called exec() or
+ * exited. */
+static pid_t spawn_child(struct child_context *context)
+{
+  void *stack = mmap(NULL, CLONE_STACK_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+  sigset_t all_signals;
+  pid_t pid;
+  int errsv;
+
+  if (stack == MAP_FAILED)
+    return -1;
+
+  /* The child must not use the cached descriptor of /dev/null before it is
+   * opened here because it cannot store it. */
+  (void) open_devnull();
+
+  (void) sigfillset(&all_signals);
+  (void) pthread_sigmask(SIG_SETMASK, &all_signals, &context->signal_mask);
+
+  /* The stack grows down on all architectures Linux runs vlock on. */
+  pid = clone(clone_child, (char *) stack + CLONE_STACK_SIZE,
+              CLONE_VM | CLONE_VFORK | SIGCHLD, context);
+  errsv = errno;
+
+  (void) pthread_sigmask(SIG_SETMASK, &context->signal_mask, NULL);
+  (void) munmap(stack, CLONE_STACK_SIZE);
+
+  errno = errsv;
+  return pid;
+}
+#else
+/* Start a child that executes a program. */
+static pid_t spawn_child(struct child_context *context)
+{
+  pid_t pid = fork();
+
+  if (pid == 0)
+    _exit(exec_child(context));
+
+  return pid;
+}
+#endif
+
+bool create_child(struct child_process *child, GError **error)
+{
+  int child_errno = 0;
+  int status_pipe[2];
+  struct child_context context = { .child = child };
+  /* A child can only be restarted with the same descriptors. */
+  bool restartable = (child->stdin_fd != REDIRECT_PIPE &&
+                      child->stdout_fd != REDIRECT_PIPE &&
+                      child->stderr_fd != REDIRECT_PIPE);
 
   if (pipe(status_pipe) < 0)
     return false;
 
   (void) fcntl(status_pipe[1], F_SETFD, FD_CLOEXEC);
 
+  context.status_fd = status_pipe[1];
+
   if (child->stdin_fd == REDIRECT_PIPE)
-    if (pipe(stdin_pipe) < 0) {
+    if (pipe(context.stdin_pipe) < 0) {
       g_set_error(error,
                   VLOCK_PROCESS_ERROR,
                   VLOCK_PROCESS_ERROR_FAILED,
@@ -165,7 +891,7 @@ bool create_child(struct child_process *child, GError **error)
     }
 
   if (child->stdout_fd == REDIRECT_PIPE)
-    if (pipe(stdout_pipe) < 0) {
+    if (pipe(context.stdout_pipe) < 0) {
       g_set_error(error,
                   VLOCK_PROCESS_ERROR,
                   VLOCK_PROCESS_ERROR_FAILED,
@@ -175,7 +901,7 @@ bool create_child(struct child_process *child, GError **error)
     }
 
   if (child->stderr_fd == REDIRECT_PIPE)
-    if (pipe(stderr_pipe) < 0) {
+    if (pipe(context.stderr_pipe) < 0) {
       g_set_error(error,
                   VLOCK_PROCESS_ERROR,
                   VLOCK_PROCESS_ERROR_FAILED,
@@ -184,53 +910,17 @@ bool create_child(struct child_process *child, GError **error)
       goto stderr_pipe_failed;
     }
 
-  child->pid = fork();
-
-  if (child->pid == 0) {
-    /* Child. */
-    fd_set except_fds;
-
-    if (child->stdin_fd == REDIRECT_PIPE)
-      (void) dup2(stdin_pipe[0], STDIN_FILENO);
-    else if (child->stdin_fd == REDIRECT_DEV_NULL)
-      (void) dup2(open_devnull(), STDIN_FILENO);
-    else if (child->stdin_fd != NO_REDIRECT)
-      (void) dup2(child->stdin_fd, STDIN_FILENO);
-
-    if (child->stdout_fd == REDIRECT_PIPE)
-      (void) dup2(stdout_pipe[1], STDOUT_FILENO);
-    else if (child->stdout_fd == REDIRECT_DEV_NULL)
-      (void) dup2(open_devnull(), STDOUT_FILENO);
-    else if (child->stdout_fd != NO_REDIRECT)
-      (void) dup2(child->stdout_fd, STDOUT_FILENO);
-
-    if (child->stderr_fd == REDIRECT_PIPE)
-      (void) dup2(stderr_pipe[1], STDERR_FILENO);
-    else if (child->stderr_fd == REDIRECT_DEV_NULL)
-      (void) dup2(open_devnull(), STDERR_FILENO);
-    else if (child->stderr_fd != NO_REDIRECT)
-      (void) dup2(child->stderr_fd, STDERR_FILENO);
-
-    FD_ZERO(&except_fds);
-    FD_SET(STDIN_FILENO, &except_fds);
-    FD_SET(STDOUT_FILENO, &except_fds);
-    FD_SET(STDERR_FILENO, &except_fds);
-    FD_SET(status_pipe[1], &except_fds);
-
-    (void) close_fds(&except_fds);
-
-    (void) setgid(getgid());
-    (void) setuid(getuid());
-
-    if (child->function != NULL) {
+  if (child->function != NULL) {
+    child->pid = fork();
+
+    if (child->pid == 0) {
+      /* Child. */
+      setup_child(&context);
       (void) close(status_pipe[1]);
       _exit(child->function(child->argument));
-    } else {
-      execv(child->path, (char *const*) child->argv);
-      (void) write(status_pipe[1], &errno, sizeof errno);
     }
-
-    _exit(1);
+  } else {
+    child->pid = spawn_child(&context);
   }
 
   if (child->pid < 0) {
@@ -254,30 +944,34 @@ bool create_child(struct child_process *child, GError **error)
                 VLOCK_PROCESS_ERROR_FAILED,
                 "child process could not exec: %s",
                 g_strerror(child_errno));
+    /* The child already exited. */
+    (void) waitpid(child->pid, NULL, 0);
     goto child_failed;
   }
 
   (void) close(status_pipe[0]);
 
+  supervise_child(child, restartable);
+
   if (child->stdin_fd == REDIRECT_PIPE) {
     /* Write end. */
-    child->stdin_fd = stdin_pipe[1];
+    child->stdin_fd = context.stdin_pipe[1];
     /* Read end. */
-    (void) close(stdin_pipe[0]);
+    (void) close(context.stdin_pipe[0]);
   }
 
   if (child->stdout_fd == REDIRECT_PIPE) {
     /* Read end. */
-    child->stdout_fd = stdout_pipe[0];
+    child->stdout_fd = context.stdout_pipe[0];
     /* Write end. */
-    (void) close(stdout_pipe[1]);
+    (void) close(context.stdout_pipe[1]);
   }
 
   if (child->stderr_fd == REDIRECT_PIPE) {
     /* Read end. */
-    child->stderr_fd = stderr_pipe[0];
+    child->stderr_fd = context.stderr_pipe[0];
     /* Write end. */
-    (void) close(stderr_pipe[1]);
+    (void) close(context.stderr_pipe[1]);
   }
 
   return true;
@@ -285,20 +979,20 @@ bool create_child(struct child_process *child, GError **error)
 child_failed:
 fork_failed:
   if (child->stderr_fd == REDIRECT_PIPE) {
-    (void) close(stderr_pipe[0]);
-    (void) close(stderr_pipe[1]);
+    (void) close(context.stderr_pipe[0]);
+    (void) close(context.stderr_pipe[1]);
   }
 
 stderr_pipe_failed:
   if (child->stdout_fd == REDIRECT_PIPE) {
-    (void) close(stdout_pipe[0]);
-    (void) close(stdout_pipe[1]);
+    (void) close(context.stdout_pipe[0]);
+    (void) close(context.stdout_pipe[1]);
   }
 
 stdout_pipe_failed:
   if (child->stdin_fd == REDIRECT_PIPE) {
-    (void) close(stdin_pipe[0]);
-    (void) close(stdin_pipe[1]);
+    (void) close(context.stdin_pipe[0]);
+    (void) close(context.stdin_pipe[1]);
   }
 
 stdin_pipe_failed:
@@ -307,4 +1001,3 @@ stdin_pipe_failed:
 
   return false;
 }
-
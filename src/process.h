@@ -15,6 +15,7 @@
 
 #include <stdbool.h>
 #include <sys/types.h>
+#include <sys/resource.h>
 #include <glib.h>
 
 /* Errors */
@@ -28,12 +29,23 @@ enum {
 
 /* Wait for the given amount of time for the death of the given child process.
  * If the child process dies in the given amount of time or already was dead
- * true is returned and false otherwise. */
+ * true is returned and false otherwise.  If no time is given wait until the
+ * child dies. */
 bool wait_for_death(pid_t pid, long sec, long usec);
 
+/* Wait for the death of all given child processes with a single deadline.
+ * Children whose element of dead is already set are skipped.  The element of
+ * each child that died is set.  Returns true if all children are dead. */
+bool wait_for_deaths(const pid_t pids[], bool dead[], size_t nr_pids,
+                     long sec, long usec);
+
 /* Try hard to kill the given child process. */
 void ensure_death(pid_t pid);
 
+/* Try hard to kill all given child processes.  They are sent SIGTERM at once
+ * and those that do not exit within a single shared timeout are killed. */
+void ensure_deaths(const pid_t pids[], size_t nr_pids);
+
 #define NO_REDIRECT (-2)
 #define REDIRECT_DEV_NULL (-3)
 #define REDIRECT_PIPE (-4)
@@ -56,6 +68,14 @@ struct child_process
   int stderr_fd;
   /* The child's PID. */
   pid_t pid;
+  /* A name for the child like that of the plugin it belongs to.  Only used
+   * for diagnostics.  May be NULL. */
+  const char *name;
+  /* Restart the child if it is killed by a signal that was not sent by vlock.
+   * Ignored if a pipe is requested for any of the stdio file descriptors.
+   * The struct must stay valid as long as the child runs and its pid field
+   * is updated on restart. */
+  bool restart;
 };
 
 /* Create a new child process.  All file descriptors except stdin, stdout and
@@ -65,5 +85,25 @@ struct child_process
  * If it has the value REDIRECT_PIPE a pipe will be created and one end will be
  * connected to the respective descriptor of the child.  The file descriptor of
  * the other end is stored in the field after the call.  It is up to the caller
- * to close the pipe descriptor(s). */
+ * to close the pipe descriptor(s).  The child is owned by the supervisor that
+ * reaps it and records its exit status. */
 bool create_child(struct child_process *child, GError **error);
+
+/* Start the supervisor.  SIGCHLD is blocked in the calling thread and
+ * delivered through a file descriptor instead so this must be called before
+ * any other threads are created. */
+void start_supervisor(void);
+
+/* Get the file descriptor that becomes readable when a child changed its
+ * state.  reap_children() should be called then.  Returns -1 if the
+ * supervisor is not running. */
+int get_supervisor_fd(void);
+
+/* Reap all children that exited and restart those that crashed and asked for
+ * it. */
+void reap_children(void);
+
+/* Get the exit status and the resource usage of the given child.  Returns
+ * false if the child is still running or was not created by create_child().
+ * Either pointer may be NULL. */
+bool get_child_status(pid_t pid, int *status, struct rusage *rusage);
@@ -43,34 +43,151 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <string.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
-#include <sys/select.h>
 #include <errno.h>
 
 #include <glib.h>
 
 #include "prompt.h"
+#include "loop.h"
+#include "secret.h"
+#include "terminal.h"
 
 #define PROMPT_BUFFER_SIZE 512
+#define INPUT_BUFFER_SIZE 256
 
 GQuark vlock_prompt_error_quark(void)
 {
   return g_quark_from_static_string("vlock-prompt-error-quark");
 }
 
-/* Prompt with the given string for a single line of input.  The read string is
- * returned in a new buffer that should be freed by the caller.  If reading
+/* Characters that were read from stdin but not consumed yet.  Whatever is
+ * available is read at once so that pasted input or a burst from a serial
+ * console costs a single read.  The buffer is secret memory because it holds
+ * passwords. */
+static struct
+{
+  char *data;
+  /* The next character to return. */
+  size_t start;
+  /* The end of the characters read. */
+  size_t end;
+  /* The errno value of a failed read or -1 at end of file. */
+  int error;
+  /* The watch of stdin or 0 if there is none. */
+  guint watch;
+  /* The timer for read_character(). */
+  struct loop_timer *timer;
+  /* Set when characters were read, reading failed or the timer expired. */
+  bool done;
+} input;
+
+/* Read the available characters into the buffer. */
+static bool input_ready(int fd, void __attribute__((unused)) *data)
+{
+  ssize_t length;
+
+  if (input.end == INPUT_BUFFER_SIZE) {
+    input.watch = 0;
+    return false;
+  }
+
+  length = read(fd, input.data + input.end, INPUT_BUFFER_SIZE - input.end);
+
+  if (length < 0 && (errno == EINTR || errno == EAGAIN))
+    return true;
+
+  input.done = true;
+
+  if (length > 0) {
+    input.end += (size_t) length;
+    return true;
+  }
+
+  input.error = (length < 0) ? errno : -1;
+  input.watch = 0;
+
+  return false;
+}
+
+/* Whether characters typed before a prompt are kept. */
+static bool type_ahead;
+
+void keep_type_ahead(bool keep)
+{
+  type_ahead = keep;
+}
+
+static void input_timeout(void __attribute__((unused)) *data)
+{
+  input.done = true;
+}
+
+/* Discard all characters that were not consumed yet. */
+static void discard_input(void)
+{
+  if (input.data != NULL)
+    memset(input.data, 0, input.end);
+
+  input.start = input.end = 0;
+  (void) tcflush(STDIN_FILENO, TCIFLUSH);
+}
+
+/* Read the next character of a line.  If there is none yet the timer is
+ * armed for the inactivity timeout or the rest of the time until the deadline,
+ * whichever is shorter.  It is rearmed for every keystroke. */
+static char next_character(const struct prompt_timeout *timeout,
+                           GError **error)
+{
+  const struct timespec *wait;
+  struct timespec remaining;
+
+  if (timeout == NULL || input.start < input.end)
+    return read_character(NULL, error);
+
+  wait = timeout->inactivity;
+
+  if (timeout->deadline != 0) {
+    gint64 left = MAX(timeout->deadline - g_get_monotonic_time(), 0);
+
+    remaining.tv_sec = (time_t) (left / G_USEC_PER_SEC);
+    remaining.tv_nsec = (long) (left % G_USEC_PER_SEC) * 1000;
+
+    if (wait == NULL ||
+        remaining.tv_sec < wait->tv_sec ||
+        (remaining.tv_sec == wait->tv_sec &&
+         remaining.tv_nsec < wait->tv_nsec))
+      wait = &remaining;
+  }
+
+  return read_character(wait, error);
+}
+
+/* Prompt with the given string for a single line of input and the given local
+ * modes of the terminal switched off.  The line is read directly into secret
+ * memory that should be freed with secret_free() by the caller.  If reading
  * fails or the timeout (if given) occurs NULL is retured. */
-char *prompt(const char *msg, const struct timespec *timeout, GError **error)
+static char *read_line(const char *msg,
+                       tcflag_t off,
+                       const struct prompt_timeout *timeout,
+                       GError **error)
 {
   GError *err = NULL;
-  char buffer[PROMPT_BUFFER_SIZE];
-  char *result = NULL;
+  char *buffer;
   size_t len;
-  struct termios term;
-  tcflag_t lflag;
+
+  if ((buffer = secret_alloc(PROMPT_BUFFER_SIZE)) == NULL) {
+    g_propagate_error(error,
+                      g_error_new_literal(
+                        VLOCK_PROMPT_ERROR,
+                        VLOCK_PROMPT_ERROR_FAILED,
+                        g_strerror(errno)));
+    return NULL;
+  }
 
   if (msg != NULL) {
     /* Write out the prompt. */
@@ -78,23 +195,21 @@ char *prompt(const char *msg, const struct timespec *timeout, GError **error)
     fflush(stderr);
   }
 
-  /* Get the current terminal attributes. */
-  (void) tcgetattr(STDIN_FILENO, &term);
-  /* Save the lflag value. */
-  lflag = term.c_lflag;
-  /* Disable terminal signals. */
-  term.c_lflag &= ~ISIG;
-  /* Set the terminal attributes. */
-  (void) tcsetattr(STDIN_FILENO, TCSAFLUSH, &term);
-  /* Discard all unread input characters. */
-  (void) tcflush(STDIN_FILENO, TCIFLUSH);
+  /* Disable terminal signals and line buffering.  Characters are read one at
+   * a time. */
+  push_terminal_mode(ISIG | ICANON | off);
+  /* Discard all unread input characters unless they are wanted. */
+  if (!type_ahead)
+    discard_input();
 
   /* Read the string one character at a time. */
-  for (len = 0; len < sizeof buffer - 1; len++) {
-    char c = wait_for_character(NULL, timeout, &err);
+  for (len = 0; len < PROMPT_BUFFER_SIZE - 1; len++) {
+    char c = next_character(timeout, &err);
 
     if (err != NULL) {
       g_propagate_error(error, err);
+      secret_free(buffer);
+      buffer = NULL;
       goto out;
     } else if (c == '\n') {
       break;
@@ -106,108 +221,171 @@ char *prompt(const char *msg, const struct timespec *timeout, GError **error)
   /* Terminate the string. */
   buffer[len] = '\0';
 
-  /* Copy the string. */
-  if ((result = strdup(buffer)) == NULL)
-    g_propagate_error(error,
-                      g_error_new_literal(
-                        VLOCK_PROMPT_ERROR,
-                        VLOCK_PROMPT_ERROR_FAILED,
-                        g_strerror(errno)));
-
-  /* Clear our buffer. */
-  memset(buffer, 0, sizeof buffer);
-
 out:
-  /* Restore original terminal attributes. */
-  term.c_lflag = lflag;
-  (void) tcsetattr(STDIN_FILENO, TCSAFLUSH, &term);
+  /* Restore the previous terminal mode and discard what was typed after the
+   * line.  The mode is changed lazily so the next prompt can reuse it. */
+  pop_terminal_mode();
 
-  return result;
+  if (!type_ahead)
+    discard_input();
+
+  return buffer;
 }
 
-/* Same as prompt except that the characters entered are not echoed. */
-char *prompt_echo_off(const char *msg,
-                      const struct timespec *timeout,
-                      GError **error)
+/* A line to read for another thread. */
+struct line_request
 {
-  struct termios term;
-  tcflag_t lflag;
+  const char *msg;
+  tcflag_t off;
+  const struct prompt_timeout *timeout;
   char *result;
+  GError *error;
+};
 
-  (void) tcgetattr(STDIN_FILENO, &term);
-  lflag = term.c_lflag;
-  term.c_lflag &= ~ECHO;
-  (void) tcsetattr(STDIN_FILENO, TCSAFLUSH, &term);
-
-  result = prompt(msg, timeout, error);
+static void run_line_request(void *data)
+{
+  struct line_request *request = data;
 
-  term.c_lflag = lflag;
-  (void) tcsetattr(STDIN_FILENO, TCSAFLUSH, &term);
+  request->result = read_line(request->msg,
+                              request->off,
+                              request->timeout,
+                              &request->error);
 
-  if (result != NULL)
+  if (request->result != NULL && (request->off & ECHO) != 0)
     fputc('\n', stderr);
+}
 
-  return result;
+/* Read the line from the loop thread which owns the terminal.  Prompts of an
+ * authentication worker that was cancelled fail with a timeout. */
+static char *request_line(const char *msg,
+                          tcflag_t off,
+                          const struct prompt_timeout *timeout,
+                          GError **error)
+{
+  struct line_request request = {
+    .msg = msg,
+    .off = off,
+    .timeout = timeout,
+    .result = NULL,
+    .error = NULL,
+  };
+
+  if (!loop_call(run_line_request, &request))
+    request.error = g_error_new_literal(VLOCK_PROMPT_ERROR,
+                                        VLOCK_PROMPT_ERROR_TIMEOUT,
+                                        "");
+
+  if (request.error != NULL)
+    g_propagate_error(error, request.error);
+
+  return request.result;
 }
 
-/* Read a single character from the stdin.  If the timeout is reached
- * 0 is returned. */
-char read_character(const struct timespec *timeout, GError **error)
+char *prompt(const char *msg,
+             const struct prompt_timeout *timeout,
+             GError **error)
 {
-  char c = 0;
-  struct timeval *timeout_val = NULL;
-  fd_set readfds;
+  return request_line(msg, 0, timeout, error);
+}
 
+/* Same as prompt except that the characters entered are not echoed. */
+char *prompt_echo_off(const char *msg,
+                      const struct prompt_timeout *timeout,
+                      GError **error)
+{
+  return request_line(msg, ECHO, timeout, error);
+}
+
+/* Wait until there is at least one character in the buffer.  Returns false if
+ * reading fails or the timeout is reached. */
+static bool fill_input(const struct timespec *timeout, GError **error)
+{
   g_assert(error == NULL || *error == NULL);
 
-before_select:
-  if (timeout != NULL) {
-    timeout_val = calloc(sizeof *timeout_val, 1);
+  if (input.start == input.end) {
+    input.start = input.end = 0;
 
-    if (timeout_val != NULL) {
-      timeout_val->tv_sec = timeout->tv_sec;
-      timeout_val->tv_usec = timeout->tv_nsec / 1000;
+    if (input.data == NULL) {
+      input.data = secret_map(INPUT_BUFFER_SIZE);
+
+      if (input.data == NULL)
+        input.error = errno;
     }
-  }
 
-  /* Initialize file descriptor set. */
-  FD_ZERO(&readfds);
-  FD_SET(STDIN_FILENO, &readfds);
-
-  /* Reset errno. */
-  errno = 0;
-
-  /* Wait for a character. */
-  if (select(STDIN_FILENO + 1, &readfds, NULL, NULL, timeout_val) != 1) {
-    switch (errno) {
-      case EINTR:
-	/* A signal was caught.  Restart. */
-	free(timeout_val);
-	goto before_select;
-      case 0:
-	/* Timeout was hit. */
-	g_propagate_error(error,
-			  g_error_new_literal(
+    /* A failed read is reported before waiting again. */
+    if (input.error == 0) {
+      (void) apply_terminal_mode();
+
+      if (input.watch == 0)
+        input.watch = loop_watch_fd(STDIN_FILENO, input_ready, NULL);
+
+      if (timeout != NULL) {
+        if (input.timer == NULL)
+          input.timer = loop_timer_new(input_timeout, NULL);
+
+        loop_timer_start(input.timer, timeout);
+      }
+
+      input.done = false;
+      loop_run(&input.done);
+
+      if (timeout != NULL)
+        loop_timer_stop(input.timer);
+    }
+
+    if (input.end == 0) {
+      int error_number = input.error;
+
+      /* Try again on the next call. */
+      input.error = 0;
+
+      if (error_number == 0)
+        g_propagate_error(error,
+                          g_error_new_literal(
                             VLOCK_PROMPT_ERROR,
-			    VLOCK_PROMPT_ERROR_TIMEOUT,
-			    ""));
-	goto out;
-      default:
-	/* Some other error. */
-	g_propagate_error(error,
-			  g_error_new_literal(
+                            VLOCK_PROMPT_ERROR_TIMEOUT,
+                            ""));
+      else
+        g_propagate_error(error,
+                          g_error_new_literal(
                             VLOCK_PROMPT_ERROR,
-			    VLOCK_PROMPT_ERROR_FAILED,
-			    g_strerror(errno)));
-	goto out;
+                            VLOCK_PROMPT_ERROR_FAILED,
+                            (error_number > 0) ? g_strerror(error_number)
+                                               : "end of file"));
+
+      return false;
     }
   }
 
-  /* Read the character. */
-  (void) read(STDIN_FILENO, &c, 1);
+  return true;
+}
+
+/* Read a single character from the stdin.  If the timeout is reached
+ * 0 is returned.  Other events are handled while waiting. */
+char read_character(const struct timespec *timeout, GError **error)
+{
+  char c;
+
+  if (!fill_input(timeout, error))
+    return 0;
+
+  c = input.data[input.start];
+  input.data[input.start++] = 0;
+
+  return c;
+}
+
+char peek_character(const struct timespec *timeout, GError **error)
+{
+  char c = 0;
+
+  push_terminal_mode(ICANON);
+
+  if (fill_input(timeout, error))
+    c = input.data[input.start];
+
+  pop_terminal_mode();
 
-out:
-  free(timeout_val);
   return c;
 }
 
@@ -216,15 +394,10 @@ out:
  * timeout occurs. */
 char wait_for_character(const char *charset, const struct timespec *timeout, GError **error)
 {
-  struct termios term;
-  tcflag_t lflag;
   char c;
 
   /* switch off line buffering */
-  (void) tcgetattr(STDIN_FILENO, &term);
-  lflag = term.c_lflag;
-  term.c_lflag &= ~ICANON;
-  (void) tcsetattr(STDIN_FILENO, TCSANOW, &term);
+  push_terminal_mode(ICANON);
 
   for (;;) {
     c = read_character(timeout, error);
@@ -236,9 +409,7 @@ char wait_for_character(const char *charset, const struct timespec *timeout, GEr
   }
 
   /* restore line buffering */
-  term.c_lflag = lflag;
-  (void) tcsetattr(STDIN_FILENO, TCSANOW, &term);
+  pop_terminal_mode();
 
   return c;
 }
-
@@ -41,6 +41,7 @@
  *
  */
 
+#include <stdbool.h>
 #include <glib.h>
 
 #define VLOCK_PROMPT_ERROR vlock_prompt_error_quark()
@@ -51,22 +52,48 @@ enum {
   VLOCK_PROMPT_ERROR_TIMEOUT,
 };
 
+/* Limits for entering a string at a prompt. */
+struct prompt_timeout
+{
+  /* The time allowed between two keystrokes or NULL. */
+  const struct timespec *inactivity;
+  /* The monotonic time as returned by g_get_monotonic_time() after which
+   * reading fails regardless of keystrokes or 0. */
+  gint64 deadline;
+};
+
 /* Prompt for a string with the given message.  The string is returned if
- * successfully read, otherwise NULL.  The caller is responsible for freeing
- * the resulting buffer.  If no string is read after the given timeout this
- * prompt() returns NULL.  A timeout of NULL means no timeout, i.e. wait forever.
+ * successfully read, otherwise NULL.  The string is kept in secret memory and
+ * the caller is responsible for freeing it with secret_free().  If no key is
+ * pressed for the inactivity timeout or the deadline passes prompt() fails
+ * with VLOCK_PROMPT_ERROR_TIMEOUT.  A timeout of NULL means no timeout, i.e.
+ * wait forever.  If called from a loop worker the prompt is shown by the
+ * thread running the loop.
  */
-char *prompt(const char *msg, const struct timespec *timeout, GError **error);
+char *prompt(const char *msg,
+             const struct prompt_timeout *timeout,
+             GError **error);
 
 /* Same as prompt() above, except that characters entered are not echoed. */
 char *prompt_echo_off(const char *msg,
-                      const struct timespec *timeout,
+                      const struct prompt_timeout *timeout,
                       GError **error);
 
 /* Read a single character from the stdin.  If the timeout is reached
- * 0 is returned. */
+ * 0 is returned.  The event loop runs while waiting.  All characters that are
+ * available are read at once and returned by the following calls.  Pending
+ * changes of the terminal mode are applied before waiting so the caller should
+ * push a mode without line buffering if necessary. */
 char read_character(const struct timespec *timeout, GError **error);
 
+/* Return the next character from stdin without consuming it.  Line buffering
+ * is switched off while waiting.  Returns 0 when the timeout occurs. */
+char peek_character(const struct timespec *timeout, GError **error);
+
+/* Keep characters that were typed before a prompt appeared or after its line
+ * was entered for the next prompt instead of discarding them. */
+void keep_type_ahead(bool keep);
+
 /* Wait for any of the characters in the given character set to be read from
  * stdin.  If charset is NULL wait for any character.  Returns 0 when the
  * timeout occurs. */
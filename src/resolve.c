@@ -0,0 +1,268 @@
+/* resolve.c -- plugin dependency resolver for vlock,
+ *              the VT locking program for linux
+ *
+ * This program is copyright (C) 2007 Frank Benkstein, and is free
+ * software which is freely distributable under the terms of the
+ * GNU General Public License version 2, included as the file COPYING in this
+ * distribution.  It is NOT public domain software, and any
+ * redistribution not permitted by the GNU General Public License is
+ * expressly forbidden without prior written permission from
+ * the author.
+ *
+ */
+
+/* The resolver first loads all required plugins.  Then it looks up every
+ * dependency once and stores it as an index into the array of plugins.  All
+ * following checks only work on these indices and arrays of flags. */
+
+#include <stdlib.h>
+#include <errno.h>
+
+#include <glib.h>
+
+#include "plugin.h"
+
+#include "resolve.h"
+
+/* The dependencies of one kind of all plugins.  The dependencies of plugin i
+ * are targets[first[i]] to targets[first[i+1]-1].  Dependencies on plugins
+ * that are not loaded have the number of plugins as their target. */
+struct adjacency
+{
+  size_t *first;
+  size_t *targets;
+  /* The names of the targets for error messages. */
+  const char **names;
+};
+
+/* Look up the index of the named plugin.  The name must be interned.  Returns
+ * the number of plugins if it is not loaded. */
+static size_t lookup(GHashTable *indices, const char *name, size_t nr_plugins)
+{
+  /* Indices are stored off by one to tell index 0 from a missing plugin. */
+  size_t index = GPOINTER_TO_SIZE(g_hash_table_lookup(indices, name));
+
+  return (index > 0) ? index - 1 : nr_plugins;
+}
+
+/* Add the plugin at the given index to the index table.  If there are plugins
+ * with the same name the first one is found. */
+static void add_index(GHashTable *indices,
+                      GPtrArray *plugins,
+                      size_t index,
+                      const struct resolve_ops *ops)
+{
+  const char *name = g_intern_string(ops->get_name(plugins->pdata[index]));
+
+  if (g_hash_table_lookup(indices, name) == NULL)
+    g_hash_table_insert(indices, (gpointer) name, GSIZE_TO_POINTER(index + 1));
+}
+
+static void build_adjacency(struct adjacency *a,
+                            GPtrArray *plugins,
+                            size_t dependency,
+                            GHashTable *indices,
+                            const struct resolve_ops *ops)
+{
+  size_t nr_plugins = plugins->len;
+  size_t nr_targets = 0;
+
+  a->first = g_new(size_t, nr_plugins + 1);
+
+  for (size_t i = 0; i < nr_plugins; i++) {
+    a->first[i] = nr_targets;
+    nr_targets += g_list_length(ops->get_dependencies(plugins->pdata[i],
+                                                      dependency));
+  }
+
+  a->first[nr_plugins] = nr_targets;
+  a->targets = g_new(size_t, nr_targets);
+  a->names = g_new(const char *, nr_targets);
+
+  for (size_t i = 0; i < nr_plugins; i++) {
+    size_t j = a->first[i];
+
+    for (GList *item = ops->get_dependencies(plugins->pdata[i], dependency);
+         item != NULL;
+         item = g_list_next(item), j++) {
+      a->names[j] = item->data;
+      a->targets[j] = lookup(indices, item->data, nr_plugins);
+    }
+  }
+}
+
+static void clear_adjacency(struct adjacency *a)
+{
+  g_free(a->first);
+  g_free(a->targets);
+  g_free(a->names);
+}
+
+/* Load plugins that are required.  This also takes care of plugins that are
+ * required by the plugins loaded here because they are appended to the end of
+ * the array. */
+static bool load_required(GPtrArray *plugins,
+                          GHashTable *indices,
+                          const struct resolve_ops *ops,
+                          GError **error)
+{
+  for (size_t i = 0; i < plugins->len; i++) {
+    void *p = plugins->pdata[i];
+
+    for (GList *item = ops->get_dependencies(p, REQUIRES);
+         item != NULL;
+         item = g_list_next(item)) {
+      const char *d = item->data;
+      void *q;
+
+      if (lookup(indices, d, plugins->len) < plugins->len)
+        continue;
+
+      q = ops->load(d);
+
+      if (q == NULL) {
+        g_set_error(
+          error,
+          VLOCK_PLUGIN_ERROR,
+          VLOCK_PLUGIN_ERROR_DEPENDENCY,
+          "'%s' requires '%s' which could not be loaded", ops->get_name(p), d);
+        return false;
+      }
+
+      g_ptr_array_add(plugins, q);
+      add_index(indices, plugins, plugins->len - 1, ops);
+    }
+  }
+
+  return true;
+}
+
+bool resolve_plugins(GPtrArray *plugins,
+                     const struct resolve_ops *ops,
+                     GError **error)
+{
+  GHashTable *indices = g_hash_table_new(g_direct_hash, g_direct_equal);
+  struct adjacency needs;
+  struct adjacency depends;
+  struct adjacency conflicts;
+  bool *required;
+  bool *loaded;
+  size_t nr_plugins;
+  bool result = false;
+
+  for (size_t i = 0; i < plugins->len; i++)
+    add_index(indices, plugins, i, ops);
+
+  if (!load_required(plugins, indices, ops, error)) {
+    g_hash_table_destroy(indices);
+    return false;
+  }
+
+  nr_plugins = plugins->len;
+
+  build_adjacency(&needs, plugins, NEEDS, indices, ops);
+  build_adjacency(&depends, plugins, DEPENDS, indices, ops);
+  build_adjacency(&conflicts, plugins, CONFLICTS, indices, ops);
+
+  g_hash_table_destroy(indices);
+
+  required = g_new(bool, nr_plugins);
+  loaded = g_new(bool, nr_plugins);
+
+  /* Plugins that require other plugins count as required themselves. */
+  for (size_t i = 0; i < nr_plugins; i++) {
+    required[i] = (ops->get_dependencies(plugins->pdata[i], REQUIRES) != NULL);
+    loaded[i] = true;
+  }
+
+  /* Fail if a plugin that is needed is not loaded. */
+  for (size_t i = 0; i < nr_plugins; i++)
+    for (size_t j = needs.first[i]; j < needs.first[i + 1]; j++) {
+      if (needs.targets[j] == nr_plugins) {
+        g_set_error(
+          error,
+          VLOCK_PLUGIN_ERROR,
+          VLOCK_PLUGIN_ERROR_DEPENDENCY,
+          "'%s' needs '%s' which is not loaded",
+          ops->get_name(plugins->pdata[i]),
+          needs.names[j]);
+        errno = 0;
+        goto out;
+      }
+
+      required[needs.targets[j]] = true;
+    }
+
+  /* Drop plugins whose prerequisites are not present, fail if those plugins
+   * are required.  A plugin is dropped if one of its prerequisites was
+   * dropped before. */
+  for (size_t i = 0; i < nr_plugins; i++)
+    for (size_t j = depends.first[i]; j < depends.first[i + 1]; j++) {
+      size_t t = depends.targets[j];
+
+      if (t < nr_plugins && loaded[t])
+        continue;
+
+      /* Abort if dependencies not met and plugin is required. */
+      if (required[i]) {
+        g_set_error(
+          error,
+          VLOCK_PLUGIN_ERROR,
+          VLOCK_PLUGIN_ERROR_DEPENDENCY,
+          "'%s' is required by some other plugin but depends on '%s' which is not loaded",
+          ops->get_name(plugins->pdata[i]),
+          depends.names[j]);
+        errno = 0;
+        goto out;
+      }
+
+      loaded[i] = false;
+      break;
+    }
+
+  /* Fail if conflicting plugins are loaded. */
+  for (size_t i = 0; i < nr_plugins; i++) {
+    if (!loaded[i])
+      continue;
+
+    for (size_t j = conflicts.first[i]; j < conflicts.first[i + 1]; j++) {
+      size_t t = conflicts.targets[j];
+
+      if (t < nr_plugins && loaded[t]) {
+        g_set_error(
+          error,
+          VLOCK_PLUGIN_ERROR,
+          VLOCK_PLUGIN_ERROR_DEPENDENCY,
+          "'%s' and '%s' cannot be loaded at the same time",
+          ops->get_name(plugins->pdata[i]),
+          conflicts.names[j]);
+        errno = 0;
+        goto out;
+      }
+    }
+  }
+
+  /* Remove the dropped plugins. */
+  {
+    size_t nr_loaded = 0;
+
+    for (size_t i = 0; i < nr_plugins; i++)
+      if (loaded[i])
+        plugins->pdata[nr_loaded++] = plugins->pdata[i];
+      else
+        ops->unload(plugins->pdata[i]);
+
+    g_ptr_array_set_size(plugins, nr_loaded);
+  }
+
+  result = true;
+
+out:
+  g_free(loaded);
+  g_free(required);
+  clear_adjacency(&conflicts);
+  clear_adjacency(&depends);
+  clear_adjacency(&needs);
+
+  return result;
+}
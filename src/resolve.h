@@ -0,0 +1,47 @@
+/* resolve.h -- header file for the plugin dependency resolver for vlock,
+ *              the VT locking program for linux
+ *
+ * This program is copyright (C) 2007 Frank Benkstein, and is free
+ * software which is freely distributable under the terms of the
+ * GNU General Public License version 2, included as the file COPYING in this
+ * distribution.  It is NOT public domain software, and any
+ * redistribution not permitted by the GNU General Public License is
+ * expressly forbidden without prior written permission from
+ * the author.
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <glib.h>
+
+/* Functions used by the resolver to access plugins.  Plugins are opaque to the
+ * resolver. */
+struct resolve_ops
+{
+  /* Get the name of the plugin. */
+  const char *(*get_name)(void *plugin);
+  /* Get the list of plugin names of the given dependency.  The names must be
+   * interned with g_intern_string(). */
+  GList *(*get_dependencies)(void *plugin, size_t dependency);
+  /* Load the named plugin.  Returns NULL if it could not be loaded. */
+  void *(*load)(const char *name);
+  /* Unload a plugin that was dropped. */
+  void (*unload)(void *plugin);
+};
+
+/* Resolve the "requires", "needs", "depends" and "conflicts" dependencies of
+ * the given plugins:
+ *
+ *  - plugins that are required are loaded and appended to the array
+ *  - fails if a plugin that is needed is not loaded
+ *  - plugins that depend on plugins that are not loaded are dropped, in the
+ *    order of the array, fails if such a plugin is required
+ *  - fails if conflicting plugins are loaded
+ *
+ * On success the dropped plugins are removed from the array and unloaded.  On
+ * error the array contains all plugins. */
+bool resolve_plugins(GPtrArray *plugins,
+                     const struct resolve_ops *ops,
+                     GError **error);
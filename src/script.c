@@ -13,17 +13,35 @@
 /* Scripts are executables that are run as unprivileged child processes of
  * vlock.  They communicate with vlock through stdin and stdout.
  *
- * When dependencies are retrieved they are launched once for each dependency
- * and should print the names of the plugins they depend on on stdout one per
- * line.  The dependency requested is given as a single command line argument.
+ * When dependencies are retrieved the script is first launched with
+ * "manifest" as a single command line argument.  If it supports this it
+ * prints all its dependencies at once in the manifest format described in
+ * PLUGINS.  Otherwise it is launched once for each dependency and should
+ * print the names of the plugins it depends on on stdout one per line.  The
+ * dependency requested is given as a single command line argument.  The
+ * result is stored in the dependency cache so the script does not have to be
+ * started again until it changes.
  *
- * In hook mode the script is called once with "hooks" as a single command line
- * argument.  It should not exit until its stdin closes.  The hook that should
- * be executed is written to its stdin on a single line.
+ * In hook mode the script is called once with "hooks" as the first command
+ * line argument.  This happens when the plugin is activated so that all
+ * scripts start up together while vlock is still preparing to lock the
+ * console.  It should not exit until its stdin closes.  Its stdin is a
+ * socket and the hook that should be executed is written to it on a single
+ * line.
  *
- * Currently there is no way for a script to communicate errors or even success
- * to vlock.  If it exits it will linger as a zombie until the plugin is
- * destroyed.
+ * Everything a script prints on its stderr and, unless it is the socket, its
+ * stdout is kept in a small log per script.  The descriptors are read without
+ * blocking from the event loop.  Only the newest output is kept.  The
+ * log is printed when a hook of the script fails and, if VLOCK_DEBUG is set,
+ * when vlock exits.
+ *
+ * Scripts that declare a protocol version in their manifest get the version
+ * that is spoken as a second argument.  In protocol version 1 each hook is
+ * preceded by a sequence number and the script acknowledges it by printing
+ * the same number followed by "ok" or "failed" on its stdout, which is the
+ * same socket.  vlock waits a limited time for the acknowledgement.  Other
+ * scripts cannot communicate errors or even success to vlock.  A script that
+ * exits is reaped by the child supervisor and gets no further hooks.
  */
 
 #if !defined(__FreeBSD__) && !defined(_GNU_SOURCE)
@@ -36,166 +54,314 @@
 #include <unistd.h>
 #include <limits.h>
 #include <sys/select.h>
+#include <poll.h>
 #include <fcntl.h>
-#include <signal.h>
 #include <errno.h>
+#include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/stat.h>
 #include <time.h>
 
 #include <glib.h>
 #include <glib-object.h>
 
 #include "process.h"
+#include "loop.h"
 #include "util.h"
 
 #include "plugin.h"
 #include "script.h"
+#include "cache.h"
+
+/* The manifest holds all dependencies so it may be larger than a single
+ * dependency. */
+#define MANIFEST_MAX (nr_dependencies * LINE_MAX)
+
+/* All probes that are run together must finish within one second. */
+#define PROBE_TIMEOUT_USEC 1000000L
+
+/* The newest version of the hook protocol vlock speaks. */
+#define SCRIPT_PROTOCOL_VERSION 1
 
-static char *read_dependency(const char *path,
-                             const char *dependency_name,
-                             GError **error);
-static void parse_dependency(char *data, GList **dependency_list);
+/* How much output of each script is kept. */
+#define SCRIPT_LOG_SIZE 4096
 
-/* Get the dependency from the script. */
-static bool get_dependency(const char *path, const char *dependency_name,
-                           GList **dependency_list, GError **error)
+/* Move what can be read from the given non-blocking descriptor to the log.
+ * At most as much as fits is read so that a chatty script cannot keep vlock
+ * busy.  Returns false on end of file or error. */
+static bool drain_log(int fd, struct ring_buffer *log)
 {
-  GError *tmp_error = NULL;
+  char buffer[LINE_MAX];
+  size_t total = 0;
 
-  /* Read the dependency data. */
-  char *data = read_dependency(path, dependency_name, &tmp_error);
+  while (total < log->size) {
+    ssize_t length = read(fd, buffer, sizeof buffer);
 
-  if (data == NULL) {
-    if (tmp_error != NULL) {
-      g_propagate_error(error, tmp_error);
-      return false;
-    } else
-      /* No data. */
-      return true;
-  }
+    if (length < 0 && errno == EINTR)
+      continue;
 
-  /* Parse the dependency data into the list. */
-  parse_dependency(data, dependency_list);
+    if (length <= 0)
+      return length < 0 && errno == EAGAIN;
 
-  g_free(data);
+    ring_buffer_append(log, buffer, length);
+    total += length;
+  }
 
   return true;
 }
 
-/* Read the dependency data by starting the script with the name of the
- * dependency as a single command line argument.  The script should then print
- * the dependencies to its stdout one on per line. */
-static char *read_dependency(const char *path,
-                             const char *dependency_name,
-                             GError **error)
+/* Print the log of a script. */
+static void dump_log(const char *name, const struct ring_buffer *log)
 {
-  GError *tmp_error = NULL;
-  const char *argv[] = { path, dependency_name, NULL };
-  struct child_process child = {
-    .path = path,
-    .argv = argv,
-    .stdin_fd = REDIRECT_DEV_NULL,
-    .stdout_fd = REDIRECT_PIPE,
-    .stderr_fd = REDIRECT_DEV_NULL,
-    .function = NULL,
-  };
-  /* Timeout is one second. */
-  struct timeval timeout = {1, 0};
-  char *data = g_malloc(sizeof *data);
-  size_t data_length = 0;
+  char *contents;
 
-  if (!create_child(&child, &tmp_error)) {
-    g_assert(tmp_error != NULL);
-    g_propagate_error(error, tmp_error);
-    return NULL;
-  }
+  if (log->length == 0)
+    return;
 
-  /* Read the dependency from the child.  Reading fails if either the timeout
-   * elapses or more that LINE_MAX bytes are read. */
-  for (;;) {
-    struct timeval t = timeout;
-    struct timeval t1;
-    struct timeval t2;
-    char buffer[LINE_MAX];
-    ssize_t length;
+  contents = ring_buffer_dup(log);
+
+  fprintf(stderr, "vlock: %s output of script '%s':\n%s%s",
+          (log->dropped > 0) ? "last" : "all",
+          name,
+          contents,
+          (contents[log->length - 1] != '\n') ? "\n" : "");
 
-    fd_set read_fds;
+  g_free(contents);
+}
 
-    FD_ZERO(&read_fds);
-    FD_SET(child.stdout_fd, &read_fds);
+/* A probe runs a script with a single command line argument and collects what
+ * it prints on its stdout until it exits. */
+struct probe
+{
+  /* The script and its argument. */
+  const char *path;
+  const char *argument;
+  const char *argv[3];
+  /* Maximum amount of data the script may print. */
+  size_t max_length;
+  /* The running script.  Its stderr is a pipe. */
+  struct child_process child;
+  /* Where the script's stderr goes. */
+  struct ring_buffer *log;
+  /* Was the script started? */
+  bool started;
+  /* Is the script's stdout still open? */
+  bool running;
+  /* Is the script's stderr still open? */
+  bool logging;
+  /* The collected data. */
+  GString *data;
+  /* Set if the probe failed. */
+  GError *error;
+};
 
-    /* t1 is before select. */
-    (void) gettimeofday(&t1, NULL);
+static void init_probe(struct probe *probe,
+                       const char *path,
+                       const char *argument,
+                       size_t max_length,
+                       struct ring_buffer *log)
+{
+  probe->path = path;
+  probe->log = log;
+  probe->argument = argument;
+  probe->argv[0] = path;
+  probe->argv[1] = argument;
+  probe->argv[2] = NULL;
+  probe->max_length = max_length;
+  probe->started = false;
+  probe->running = false;
+  probe->logging = false;
+  probe->data = g_string_new("");
+  probe->error = NULL;
+}
 
-    if (select(child.stdout_fd+1, &read_fds, NULL, NULL, &t) != 1) {
-timeout:
-      g_set_error(&tmp_error,
-                  VLOCK_PLUGIN_ERROR,
-                  VLOCK_PLUGIN_ERROR_FAILED,
-                  "reading dependency (%s) data from script %s failed: timeout",
-                  dependency_name,
-                  /* XXX: plugin->name */ path
-                  );
-      goto error;
+static void clear_probe(struct probe *probe)
+{
+  g_string_free(probe->data, true);
+  g_clear_error(&probe->error);
+}
+
+/* Start the script of the probe. */
+static void start_probe(struct probe *probe)
+{
+  probe->child.path = probe->path;
+  probe->child.argv = probe->argv;
+  probe->child.stdin_fd = REDIRECT_DEV_NULL;
+  probe->child.stdout_fd = REDIRECT_PIPE;
+  probe->child.stderr_fd = REDIRECT_PIPE;
+  probe->child.function = NULL;
+  probe->child.name = probe->path;
+  probe->child.restart = false;
+
+  probe->started = create_child(&probe->child, &probe->error);
+  probe->running = probe->started;
+  probe->logging = probe->started;
+
+  if (probe->started)
+    (void) fcntl(probe->child.stderr_fd, F_SETFL, O_NONBLOCK);
+}
+
+/* Read the available data from the script of the probe. */
+static void read_probe(struct probe *probe)
+{
+  char buffer[LINE_MAX];
+  ssize_t length = read(probe->child.stdout_fd, buffer, sizeof buffer);
+
+  /* Did the script close its stdout or exit? */
+  if (length <= 0) {
+    probe->running = false;
+    return;
+  }
+
+  if (probe->data->len+length+1 > probe->max_length) {
+    g_set_error(
+      &probe->error,
+      VLOCK_PLUGIN_ERROR,
+      VLOCK_PLUGIN_ERROR_FAILED,
+      "reading %s data from script %s failed: too much data",
+      probe->argument,
+      /* XXX: plugin->name */ probe->path
+      );
+    probe->running = false;
+    return;
+  }
+
+  g_string_append_len(probe->data, buffer, length);
+}
+
+/* Close the read ends of the stdout pipes of the given probes and kill their
+ * scripts.  Scripts that printed all their data should have exited by now.
+ * All scripts are waited for together so that hanging scripts cost a single
+ * timeout. */
+static void reap_probes(struct probe *probes, size_t nr_probes)
+{
+  pid_t *pids = g_new(pid_t, nr_probes);
+  bool *dead = g_new0(bool, nr_probes);
+  size_t nr_pids = 0;
+
+  for (size_t i = 0; i < nr_probes; i++)
+    if (probes[i].started) {
+      (void) close(probes[i].child.stdout_fd);
+      pids[nr_pids++] = probes[i].child.pid;
     }
 
-    /* t2 is after select. */
-    (void) gettimeofday(&t2, NULL);
+  if (!wait_for_deaths(pids, dead, nr_pids, 0, 500000L)) {
+    size_t nr_remaining = 0;
 
-    /* Get the time that during select. */
-    timersub(&t2, &t1, &t2);
+    for (size_t i = 0; i < nr_pids; i++)
+      if (!dead[i])
+        pids[nr_remaining++] = pids[i];
 
-    /* This is very unlikely. */
-    if (timercmp(&t2, &timeout, >))
-      goto timeout;
+    ensure_deaths(pids, nr_remaining);
+  }
 
-    /* Reduce the timeout. */
-    timersub(&timeout, &t2, &timeout);
+  g_free(dead);
+  g_free(pids);
+}
 
-    /* Read dependency data from the script. */
-    length = read(child.stdout_fd, buffer, sizeof buffer - 1);
+/* Run the given probes concurrently.  All probes share a single deadline so the
+ * total time is bounded by the slowest script. */
+static void run_probes(struct probe *probes, size_t nr_probes)
+{
+  gint64 deadline = g_get_monotonic_time() + PROBE_TIMEOUT_USEC;
+  /* The stdout and stderr of each probe. */
+  struct pollfd *fds = g_new(struct pollfd, 2 * nr_probes);
+  /* Maps entries of fds to probes. */
+  size_t *fd_probes = g_new(size_t, 2 * nr_probes);
 
-    /* Did the script close its stdin or exit? */
-    if (length <= 0)
+  for (size_t i = 0; i < nr_probes; i++)
+    start_probe(&probes[i]);
+
+  for (;;) {
+    size_t nr_fds = 0;
+    gint64 timeout;
+    int result;
+
+    for (size_t i = 0; i < nr_probes; i++)
+      if (probes[i].running) {
+        fds[nr_fds].fd = probes[i].child.stdout_fd;
+        fds[nr_fds].events = POLLIN;
+        fds[nr_fds].revents = 0;
+        fd_probes[nr_fds] = i;
+        nr_fds++;
+
+        if (probes[i].logging) {
+          fds[nr_fds].fd = probes[i].child.stderr_fd;
+          fds[nr_fds].events = POLLIN;
+          fds[nr_fds].revents = 0;
+          fd_probes[nr_fds] = i;
+          nr_fds++;
+        }
+      }
+
+    if (nr_fds == 0)
       break;
 
-    if (data_length+length+1 > LINE_MAX) {
-      g_set_error(
-        &tmp_error,
-        VLOCK_PLUGIN_ERROR,
-        VLOCK_PLUGIN_ERROR_FAILED,
-        "reading dependency (%s) data from script %s failed: too much data",
-        dependency_name,
-        /* XXX: plugin->name */ path
-        );
-      goto error;
+    /* Round up to whole milliseconds. */
+    timeout = (deadline - g_get_monotonic_time() + 999) / 1000;
+
+    if (timeout > 0)
+      result = poll(fds, nr_fds, timeout);
+    else
+      result = 0;
+
+    if (result < 0 && errno == EINTR)
+      continue;
+
+    if (result <= 0) {
+      /* Every script that is still running failed. */
+      const char *reason = (result == 0) ? "timeout" : g_strerror(errno);
+
+      for (size_t i = 0; i < nr_fds; i++) {
+        struct probe *probe = &probes[fd_probes[i]];
+
+        if (!probe->running)
+          continue;
+
+        g_set_error(&probe->error,
+                    VLOCK_PLUGIN_ERROR,
+                    VLOCK_PLUGIN_ERROR_FAILED,
+                    "reading %s data from script %s failed: %s",
+                    probe->argument,
+                    /* XXX: plugin->name */ probe->path,
+                    reason
+                    );
+        probe->running = false;
+      }
+
+      break;
     }
 
-    /* Grow the data string. */
-    data = g_realloc(data, data_length+length);
+    for (size_t i = 0; i < nr_fds; i++) {
+      struct probe *probe = &probes[fd_probes[i]];
 
-    /* Append the buffer to the data string. */
-    strncpy(data+data_length, buffer, length);
-    data_length += length;
+      if (fds[i].revents == 0 || !probe->running)
+        continue;
+
+      if (fds[i].fd == probe->child.stdout_fd)
+        read_probe(probe);
+      else
+        probe->logging = drain_log(fds[i].fd, probe->log);
+    }
   }
 
-  /* Terminate the data string. */
-  data[data_length] = '\0';
+  reap_probes(probes, nr_probes);
 
-error:
-  /* Close the read end of the pipe. */
-  (void) close(child.stdout_fd);
-  /* Kill the script. */
-  if (!wait_for_death(child.pid, 0, 500000L))
-    ensure_death(child.pid);
+  for (size_t i = 0; i < nr_probes; i++) {
+    struct probe *probe = &probes[i];
 
-  if (tmp_error != NULL) {
-    g_propagate_error(error, tmp_error);
-    g_free(data);
-    data = NULL;
+    if (!probe->started)
+      continue;
+
+    /* Whatever the dead script wrote last is still in the pipe. */
+    if (probe->logging)
+      (void) drain_log(probe->child.stderr_fd, probe->log);
+
+    (void) close(probe->child.stderr_fd);
   }
 
-  return data;
+  g_free(fd_probes);
+  g_free(fds);
 }
 
 static void parse_dependency(char *data, GList **dependency_list)
@@ -205,7 +371,7 @@ static void parse_dependency(char *data, GList **dependency_list)
   for (size_t i = 0; dependency_items[i] != NULL; i++)
     *dependency_list = g_list_append(
       *dependency_list,
-      g_strdup(dependency_items[i])
+      (gpointer) g_intern_string(dependency_items[i])
       );
 
   g_strfreev(dependency_items);
@@ -225,10 +391,23 @@ struct _VlockScriptPrivate
   bool launched;
   /* Did the script die? */
   bool dead;
-  /* The pipe file descriptor that is connected to the script's stdin. */
+  /* The socket that is connected to the script's stdin and, if it speaks the
+   * hook protocol, its stdout. */
   int fd;
   /* The PID of the script. */
   pid_t pid;
+  /* The version of the hook protocol that is spoken or 0. */
+  unsigned int protocol;
+  /* The sequence number of the last hook that was sent. */
+  unsigned long sequence;
+  /* Data received from the script that is not a complete line yet. */
+  GString *input;
+  /* The newest output of the script. */
+  struct ring_buffer *log;
+  /* The pipe the script's output is read from or -1. */
+  int log_fd;
+  /* The event loop watch of the pipe. */
+  guint log_watch;
 };
 
 /* Initialize plugin to default values. */
@@ -239,6 +418,47 @@ static void vlock_script_init(VlockScript *self)
   self->priv->dead = false;
   self->priv->launched = false;
   self->priv->path = NULL;
+  self->priv->protocol = 0;
+  self->priv->sequence = 0;
+  self->priv->input = g_string_new("");
+  self->priv->log = ring_buffer_new(SCRIPT_LOG_SIZE);
+  self->priv->log_fd = -1;
+  self->priv->log_watch = 0;
+}
+
+/* Stop reading the output of the script. */
+static void close_log(VlockScript *self)
+{
+  if (self->priv->log_watch != 0)
+    loop_remove(self->priv->log_watch);
+
+  (void) close(self->priv->log_fd);
+  self->priv->log_fd = -1;
+  self->priv->log_watch = 0;
+}
+
+/* Read the output of the script that is available. */
+static void read_log(VlockScript *self)
+{
+  if (self->priv->log_fd >= 0 &&
+      !drain_log(self->priv->log_fd, self->priv->log))
+    close_log(self);
+}
+
+static bool log_ready(int __attribute__((unused)) fd, void *data)
+{
+  VlockScript *self = data;
+
+  read_log(self);
+
+  return self->priv->log_fd >= 0;
+}
+
+/* Print the log of the script after one of its hooks failed. */
+static void report_failure(VlockScript *self)
+{
+  read_log(self);
+  dump_log(VLOCK_PLUGIN(self)->name, self->priv->log);
 }
 
 static void vlock_script_finalize(GObject *object)
@@ -246,9 +466,10 @@ static void vlock_script_finalize(GObject *object)
   VlockScript *self = VLOCK_SCRIPT(object);
 
   g_free(self->priv->path);
+  g_string_free(self->priv->input, true);
 
   if (self->priv->launched) {
-    /* Close the pipe. */
+    /* Close the socket. */
     (void) close(self->priv->fd);
 
     /* Kill the child process. */
@@ -256,79 +477,443 @@ static void vlock_script_finalize(GObject *object)
       ensure_death(self->priv->pid);
   }
 
+  /* The script is dead so reading its output does not block. */
+  if (self->priv->log_fd >= 0) {
+    (void) drain_log(self->priv->log_fd, self->priv->log);
+    close_log(self);
+  }
+
+  if (g_getenv("VLOCK_DEBUG") != NULL && *g_getenv("VLOCK_DEBUG") != '\0')
+    dump_log(VLOCK_PLUGIN(self)->name, self->priv->log);
+
+  ring_buffer_free(self->priv->log);
+
   G_OBJECT_CLASS(vlock_script_parent_class)->finalize(object);
 }
 
+void vlock_script_open_all(VlockScript **scripts,
+                           GError **errors,
+                           size_t nr_scripts)
+{
+  struct stat *stats = g_new(struct stat, nr_scripts);
+  bool *have_stat = g_new(bool, nr_scripts);
+  bool *probed = g_new(bool, nr_scripts);
+  /* Maps probes to scripts. */
+  size_t *probe_scripts = g_new(size_t, nr_scripts);
+  size_t nr_probes = 0;
+  struct probe *probes = g_new(struct probe, nr_scripts);
+  /* Scripts that do not support the manifest mode. */
+  size_t *fallback_scripts = g_new(size_t, nr_scripts);
+  size_t nr_fallback_scripts = 0;
+
+  for (size_t i = 0; i < nr_scripts; i++) {
+    VlockScript *self = scripts[i];
+    VlockPlugin *plugin = VLOCK_PLUGIN(self);
+
+    errors[i] = NULL;
+
+    if (self->priv->path == NULL)
+      self->priv->path = g_strdup_printf("%s/%s",
+                                         VLOCK_SCRIPT_DIR,
+                                         plugin->name);
+
+    /* The script is executed with the privileges of the user so check the
+     * access with the real user id.  If the script is cached and executable
+     * it does not need to be started at all. */
+    have_stat[i] = (stat(self->priv->path, &stats[i]) == 0 &&
+                    S_ISREG(stats[i].st_mode));
+
+    probed[i] = !(have_stat[i] && access(self->priv->path, X_OK) == 0 &&
+                  cache_lookup_dependencies(plugin,
+                                            self->priv->path,
+                                            &stats[i]));
+
+    if (probed[i]) {
+      /* Try to get all dependencies at once. */
+      init_probe(&probes[nr_probes], self->priv->path, "manifest",
+                 MANIFEST_MAX, self->priv->log);
+      probe_scripts[nr_probes++] = i;
+    }
+  }
+
+  /* Whether the scripts are executable or not is also detected here. */
+  run_probes(probes, nr_probes);
+
+  for (size_t j = 0; j < nr_probes; j++) {
+    struct probe *probe = &probes[j];
+    size_t i = probe_scripts[j];
+
+    if (g_error_matches(probe->error,
+                        VLOCK_PROCESS_ERROR,
+                        VLOCK_PROCESS_ERROR_NOT_FOUND))
+      g_set_error(&errors[i], VLOCK_PLUGIN_ERROR,
+                  VLOCK_PLUGIN_ERROR_NOT_FOUND, "%s", probe->error->message);
+    else if (probe->error != NULL) {
+      g_propagate_error(&errors[i], probe->error);
+      probe->error = NULL;
+    }
+    /* Scripts that do not know the manifest mode typically print nothing or
+     * a usage message.  Both are not valid manifests. */
+    else if (vlock_plugin_is_manifest(probe->data->str))
+      (void) vlock_plugin_parse_manifest(VLOCK_PLUGIN(scripts[i]),
+                                         probe->data->str,
+                                         &errors[i]);
+    else
+      fallback_scripts[nr_fallback_scripts++] = i;
+
+    clear_probe(probe);
+  }
+
+  /* Fall back to getting the dependencies one at a time.  These probes are
+   * also all run at once. */
+  nr_probes = nr_fallback_scripts * nr_dependencies;
+  probes = g_renew(struct probe, probes, nr_probes);
+
+  for (size_t k = 0; k < nr_fallback_scripts; k++)
+    for (size_t d = 0; d < nr_dependencies; d++)
+      init_probe(&probes[k * nr_dependencies + d],
+                 scripts[fallback_scripts[k]]->priv->path,
+                 dependency_names[d],
+                 LINE_MAX,
+                 scripts[fallback_scripts[k]]->priv->log);
+
+  run_probes(probes, nr_probes);
+
+  for (size_t k = 0; k < nr_fallback_scripts; k++) {
+    size_t i = fallback_scripts[k];
+    VlockPlugin *plugin = VLOCK_PLUGIN(scripts[i]);
+
+    for (size_t d = 0; d < nr_dependencies; d++) {
+      struct probe *probe = &probes[k * nr_dependencies + d];
+
+      /* Report the first error only. */
+      if (probe->error != NULL && errors[i] == NULL) {
+        g_propagate_error(&errors[i], probe->error);
+        probe->error = NULL;
+      } else if (errors[i] == NULL)
+        parse_dependency(probe->data->str, &plugin->dependencies[d]);
+
+      clear_probe(probe);
+    }
+  }
+
+  for (size_t i = 0; i < nr_scripts; i++)
+    if (probed[i] && errors[i] != NULL)
+      dump_log(VLOCK_PLUGIN(scripts[i])->name, scripts[i]->priv->log);
+
+  for (size_t i = 0; i < nr_scripts; i++)
+    if (probed[i] && have_stat[i] && errors[i] == NULL)
+      cache_store_dependencies(VLOCK_PLUGIN(scripts[i]),
+                               scripts[i]->priv->path,
+                               &stats[i]);
+
+  g_free(fallback_scripts);
+  g_free(probes);
+  g_free(probe_scripts);
+  g_free(probed);
+  g_free(have_stat);
+  g_free(stats);
+}
+
+gchar **vlock_script_list_all(GError **error)
+{
+  GPtrArray *names = g_ptr_array_new();
+  GDir *dir = g_dir_open(VLOCK_SCRIPT_DIR, 0, error);
+  const gchar *name;
+
+  if (dir == NULL) {
+    g_ptr_array_free(names, true);
+    return NULL;
+  }
+
+  while ((name = g_dir_read_name(dir)) != NULL) {
+    gchar *path = g_build_filename(VLOCK_SCRIPT_DIR, name, NULL);
+
+    /* Skip hidden files and anything that cannot be run as a script. */
+    if (name[0] != '.' &&
+        g_file_test(path, G_FILE_TEST_IS_REGULAR) &&
+        g_file_test(path, G_FILE_TEST_IS_EXECUTABLE))
+      g_ptr_array_add(names, g_strdup(name));
+
+    g_free(path);
+  }
+
+  g_dir_close(dir);
+  g_ptr_array_add(names, NULL);
+
+  return (gchar **) g_ptr_array_free(names, false);
+}
+
 static bool vlock_script_open(VlockPlugin *plugin, GError **error)
 {
+  VlockScript *self = VLOCK_SCRIPT(plugin);
   GError *tmp_error = NULL;
+
+  vlock_script_open_all(&self, &tmp_error, 1);
+
+  if (tmp_error != NULL) {
+    g_propagate_error(error, tmp_error);
+    return false;
+  }
+
+  return true;
+}
+
+static bool vlock_script_locate(VlockPlugin *plugin, GError **error)
+{
   VlockScript *self = VLOCK_SCRIPT(plugin);
 
-  self->priv->path = g_strdup_printf("%s/%s", VLOCK_SCRIPT_DIR, plugin->name);
-
-  /* Get the dependency information.  Whether the script is executable or not
-   * is also detected here. */
-  for (size_t i = 0; i < nr_dependencies; i++)
-    if (!get_dependency(self->priv->path, dependency_names[i],
-                        &plugin->dependencies[i], &tmp_error)) {
-      if (g_error_matches(tmp_error,
-                          VLOCK_PROCESS_ERROR,
-                          VLOCK_PROCESS_ERROR_NOT_FOUND) && i == 0) {
-        g_set_error(error, VLOCK_PLUGIN_ERROR, VLOCK_PLUGIN_ERROR_NOT_FOUND,
-                    "%s", tmp_error->message);
-        g_clear_error(&tmp_error);
-      } else
-        g_propagate_error(error, tmp_error);
+  if (self->priv->path == NULL)
+    self->priv->path = g_strdup_printf("%s/%s", VLOCK_SCRIPT_DIR, plugin->name);
 
-      return false;
-    }
+  /* The script is executed with the privileges of the user so check the
+   * access with the real user id. */
+  if (access(self->priv->path, X_OK) < 0) {
+    gint error_code = (errno == ENOENT) ?
+                      VLOCK_PLUGIN_ERROR_NOT_FOUND :
+                      VLOCK_PLUGIN_ERROR_FAILED;
+
+    g_set_error(
+      error,
+      VLOCK_PLUGIN_ERROR,
+      error_code,
+      "could not open script '%s': %s",
+      plugin->name,
+      g_strerror(errno));
+
+    return false;
+  }
 
   return true;
 }
 
+static const gchar *vlock_script_get_path(VlockPlugin *plugin)
+{
+  return VLOCK_SCRIPT(plugin)->priv->path;
+}
+
 /* Launch the script creating a new script_context. */
 static bool vlock_script_launch(VlockScript *script, GError **error)
 {
   GError *tmp_error = NULL;
-  int fd_flags;
-  const char *argv[] = { script->priv->path, "hooks", NULL };
+  int fds[2];
+  int log_pipe[2];
+  gchar *version = NULL;
+  const char *argv[] = { script->priv->path, "hooks", NULL, NULL };
   struct child_process child = {
     .path = script->priv->path,
     .argv = argv,
-    .stdin_fd = REDIRECT_PIPE,
-    .stdout_fd = REDIRECT_DEV_NULL,
-    .stderr_fd = REDIRECT_DEV_NULL,
     .function = NULL,
+    .name = VLOCK_PLUGIN(script)->name,
   };
 
+  /* Writing to a socket can suppress SIGPIPE, writing to a pipe cannot. */
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+    g_set_error(error,
+                VLOCK_PLUGIN_ERROR,
+                VLOCK_PLUGIN_ERROR_FAILED,
+                "could not create socket for script '%s': %s",
+                VLOCK_PLUGIN(script)->name,
+                g_strerror(errno));
+    return false;
+  }
+
+  if (pipe(log_pipe) < 0) {
+    g_set_error(error,
+                VLOCK_PLUGIN_ERROR,
+                VLOCK_PLUGIN_ERROR_FAILED,
+                "could not create pipe for script '%s': %s",
+                VLOCK_PLUGIN(script)->name,
+                g_strerror(errno));
+    (void) close(fds[0]);
+    (void) close(fds[1]);
+    return false;
+  }
+
+  script->priv->protocol = MIN(VLOCK_PLUGIN(script)->protocol,
+                               SCRIPT_PROTOCOL_VERSION);
+
+  child.stdin_fd = fds[1];
+  child.stderr_fd = log_pipe[1];
+
+  if (script->priv->protocol > 0) {
+    version = g_strdup_printf("%u", script->priv->protocol);
+    argv[2] = version;
+    child.stdout_fd = fds[1];
+  } else {
+    child.stdout_fd = log_pipe[1];
+  }
+
   if (!create_child(&child, &tmp_error)) {
     g_propagate_error(error, tmp_error);
+    (void) close(fds[0]);
+    (void) close(fds[1]);
+    (void) close(log_pipe[0]);
+    (void) close(log_pipe[1]);
+    g_free(version);
     return false;
   }
 
-  script->priv->fd = child.stdin_fd;
+  (void) close(fds[1]);
+  (void) close(log_pipe[1]);
+  g_free(version);
+
+  script->priv->fd = fds[0];
   script->priv->pid = child.pid;
 
-  fd_flags = fcntl(script->priv->fd, F_GETFL, &fd_flags);
+  (void) fcntl(log_pipe[0], F_SETFL, O_NONBLOCK);
+  script->priv->log_fd = log_pipe[0];
+  script->priv->log_watch = loop_watch_fd(log_pipe[0], log_ready, script);
+
+  return true;
+}
+
+/* Take the next complete line from the data received from the script.  Returns
+ * NULL if there is none. */
+static gchar *next_line(GString *input)
+{
+  char *newline = memchr(input->str, '\n', input->len);
+  gchar *line;
+
+  if (newline == NULL)
+    return NULL;
+
+  line = g_strndup(input->str, newline - input->str);
+  g_string_erase(input, 0, newline - input->str + 1);
+
+  return line;
+}
+
+/* Wait until the given monotonic deadline for the script to acknowledge the
+ * hook with the given sequence number.  Acknowledgements of earlier hooks that
+ * arrive late are skipped.  Sets errno to ETIMEDOUT if the acknowledgement does
+ * not arrive in time. */
+static bool wait_for_ack(VlockScript *self,
+                         unsigned long sequence,
+                         gint64 deadline)
+{
+  for (;;) {
+    gchar *line;
+    struct pollfd pfd;
+    char buffer[LINE_MAX];
+    gint64 timeout;
+    ssize_t length;
+    int result;
+
+    while ((line = next_line(self->priv->input)) != NULL) {
+      char *status;
+      unsigned long acked = strtoul(line, &status, 10);
+      bool ok = (strcmp(g_strstrip(status), "ok") == 0);
+
+      g_free(line);
+
+      if (acked == sequence) {
+        errno = 0;
+        return ok;
+      }
+    }
+
+    /* Round up to whole milliseconds.  Once the deadline has passed the
+     * socket is still checked for an acknowledgement that arrived while other
+     * plugins were waited for. */
+    timeout = MAX((deadline - g_get_monotonic_time() + 999) / 1000, 0);
+
+    pfd.fd = self->priv->fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    result = poll(&pfd, 1, timeout);
+
+    if (result < 0 && errno == EINTR)
+      continue;
 
-  if (fd_flags != -1) {
-    fd_flags |= O_NONBLOCK;
-    (void) fcntl(script->priv->fd, F_SETFL, fd_flags);
+    if (result == 0) {
+      if (timeout > 0)
+        continue;
+
+      errno = ETIMEDOUT;
+      return false;
+    }
+
+    if (result > 0)
+      length = recv(self->priv->fd, buffer, sizeof buffer, MSG_DONTWAIT);
+    else
+      length = -1;
+
+    if (length < 0 && (errno == EINTR || errno == EAGAIN))
+      continue;
+
+    /* The script closed its end, failed to read or sends garbage.  It is
+     * considered dead. */
+    if (length <= 0 || self->priv->input->len + length > LINE_MAX) {
+      if (length >= 0)
+        errno = EPIPE;
+
+      self->priv->dead = true;
+      return false;
+    }
+
+    g_string_append_len(self->priv->input, buffer, length);
+  }
+}
+
+/* Close the socket so that the script exits and hand its PID to the caller.
+ * The hooks of the script cannot be called afterwards. */
+static void vlock_script_release(VlockPlugin *plugin, GArray *pids)
+{
+  VlockScript *self = VLOCK_SCRIPT(plugin);
+
+  if (!self->priv->launched)
+    return;
+
+  (void) close(self->priv->fd);
+  g_array_append_val(pids, self->priv->pid);
+
+  self->priv->launched = false;
+  self->priv->dead = true;
+}
+
+/* Launch the script in hook mode unless it implements no hooks.  The hooks of
+ * a script that cannot be launched fail. */
+static bool vlock_script_activate(VlockPlugin *plugin,
+                                  GError __attribute__((unused)) **error)
+{
+  VlockScript *self = VLOCK_SCRIPT(plugin);
+  GError *tmp_error = NULL;
+  bool has_hooks = false;
+
+  if (self->priv->launched || self->priv->dead)
+    return true;
+
+  for (size_t i = 0; i < nr_hooks; i++)
+    has_hooks = has_hooks || plugin->has_hook[i];
+
+  if (!has_hooks)
+    return true;
+
+  self->priv->launched = vlock_script_launch(self, &tmp_error);
+
+  if (!self->priv->launched) {
+    g_debug("could not launch script '%s': %s", plugin->name,
+            tmp_error->message);
+    g_clear_error(&tmp_error);
+    /* Do not retry. */
+    self->priv->dead = true;
   }
 
   return true;
 }
 
-static bool vlock_script_call_hook(VlockPlugin *plugin, const gchar *hook_name)
+/* Send the hook to the script without waiting for its acknowledgement. */
+static bool vlock_script_post_hook(VlockPlugin *plugin, size_t hook)
 {
   VlockScript *self = VLOCK_SCRIPT(plugin);
-  static const char newline = '\n';
-  ssize_t hook_name_length = strlen(hook_name);
+  gchar *message;
+  ssize_t message_length;
   ssize_t length;
-  struct sigaction act;
-  struct sigaction oldact;
 
-  if (!self->priv->launched) {
+  /* Scripts are normally launched when they are activated. */
+  if (!self->priv->launched && !self->priv->dead) {
     /* Launch script. */
     self->priv->launched = vlock_script_launch(self, NULL);
 
@@ -343,28 +928,79 @@ static bool vlock_script_call_hook(VlockPlugin *plugin, const gchar *hook_name)
     /* Nothing to do. */
     return false;
 
-  /* When writing to a pipe when the read end is closed the kernel invariably
-   * sends SIGPIPE.   Ignore it. */
-  (void) sigemptyset(&(act.sa_mask));
-  act.sa_flags = SA_RESTART;
-  act.sa_handler = SIG_IGN;
-  (void) sigaction(SIGPIPE, &act, &oldact);
+  /* Do not talk to a script that the supervisor found dead. */
+  if (get_child_status(self->priv->pid, NULL, NULL)) {
+    self->priv->dead = true;
+    report_failure(self);
+    return false;
+  }
+
+  if (self->priv->protocol > 0)
+    message = g_strdup_printf("%lu %s\n", ++self->priv->sequence,
+                              hooks[hook].name);
+  else
+    message = g_strdup_printf("%s\n", hooks[hook].name);
 
-  /* Send hook name and a newline through the pipe. */
-  length = write(self->priv->fd, hook_name, hook_name_length);
+  message_length = strlen(message);
 
-  if (length > 0)
-    length += write(self->priv->fd, &newline, sizeof newline);
+  /* Send the message without blocking and without getting SIGPIPE if the
+   * script closed its end. */
+  length = send(self->priv->fd, message, message_length,
+                MSG_NOSIGNAL | MSG_DONTWAIT);
 
-  /* Restore the previous SIGPIPE handler. */
-  (void) sigaction(SIGPIPE, &oldact, NULL);
+  g_free(message);
 
-  /* If write fails the script is considered dead. */
-  self->priv->dead = (length != hook_name_length + 1);
+  /* If sending fails the script is considered dead. */
+  self->priv->dead = (length != message_length);
+
+  if (self->priv->dead)
+    GUARD_ERRNO(report_failure(self));
 
   return !self->priv->dead;
 }
 
+/* Wait for the acknowledgement of the hook that was sent last, if the script
+ * speaks the protocol. */
+static bool vlock_script_complete_hook(VlockPlugin *plugin,
+                                       size_t __attribute__((unused)) hook,
+                                       gint64 deadline)
+{
+  VlockScript *self = VLOCK_SCRIPT(plugin);
+
+  /* Keep the pipe from filling up. */
+  read_log(self);
+
+  if (self->priv->dead)
+    return false;
+
+  if (self->priv->protocol > 0 &&
+      !wait_for_ack(self, self->priv->sequence, deadline)) {
+    GUARD_ERRNO(report_failure(self));
+    return false;
+  }
+
+  return true;
+}
+
+static bool vlock_script_call_hook(VlockPlugin *plugin, size_t hook)
+{
+  return vlock_script_post_hook(plugin, hook) &&
+         vlock_script_complete_hook(plugin, hook,
+                                    g_get_monotonic_time() +
+                                    HOOK_ACK_TIMEOUT_USEC);
+}
+
+/* The socket becomes readable when the script acknowledges a hook. */
+static int vlock_script_get_hook_fd(VlockPlugin *plugin)
+{
+  VlockScript *self = VLOCK_SCRIPT(plugin);
+
+  if (!self->priv->launched || self->priv->dead || self->priv->protocol == 0)
+    return -1;
+
+  return self->priv->fd;
+}
+
 /* Initialize script class. */
 static void vlock_script_class_init(VlockScriptClass *klass)
 {
@@ -377,6 +1013,13 @@ static void vlock_script_class_init(VlockScriptClass *klass)
   gobject_class->finalize = vlock_script_finalize;
 
   plugin_class->open = vlock_script_open;
+  plugin_class->locate = vlock_script_locate;
+  plugin_class->get_path = vlock_script_get_path;
+  plugin_class->activate = vlock_script_activate;
+  plugin_class->release = vlock_script_release;
   plugin_class->call_hook = vlock_script_call_hook;
+  plugin_class->post_hook = vlock_script_post_hook;
+  plugin_class->complete_hook = vlock_script_complete_hook;
+  plugin_class->get_hook_fd = vlock_script_get_hook_fd;
 }
 
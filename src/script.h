@@ -37,3 +37,15 @@ struct _VlockScriptClass
 };
 
 GType vlock_script_get_type(void);
+
+/* Open the given scripts at once.  Scripts whose dependencies are not cached
+ * are started concurrently and share a single timeout.  The error of each
+ * script, if any, is stored in the corresponding element of errors. */
+void vlock_script_open_all(VlockScript **scripts,
+                           GError **errors,
+                           size_t nr_scripts);
+
+/* Get the names of all scripts in the script directory as a NULL terminated
+ * array that should be freed with g_strfreev().  Returns NULL and sets error
+ * if the directory cannot be read. */
+gchar **vlock_script_list_all(GError **error);
@@ -0,0 +1,223 @@
+/* secret.c -- secret memory for vlock,
+ *             the VT locking program for linux
+ *
+ * This program is copyright (C) 2007 Frank Benkstein, and is free
+ * software which is freely distributable under the terms of the
+ * GNU General Public License version 2, included as the file COPYING in this
+ * distribution.  It is NOT public domain software, and any
+ * redistribution not permitted by the GNU General Public License is
+ * expressly forbidden without prior written permission from
+ * the author.
+ *
+ */
+
+/* Passwords are kept in memory that is never swapped out and never written
+ * to a core dump.  The arena is a single mapping that is split into blocks,
+ * each preceded by a small header.  A block that is given back is wiped and
+ * merged with free neighbours so that it can be reused even while other
+ * secrets, e.g. the password of an attempt that was given up on, are still
+ * held. */
+
+#if !defined(__FreeBSD__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/mman.h>
+
+#include <glib.h>
+
+#include "secret.h"
+
+/* The size of the arena.  A few lines of input are enough. */
+#define SECRET_ARENA_SIZE (16 * 1024)
+
+/* Alignment of each secret. */
+#define SECRET_ALIGNMENT (2 * sizeof (void *))
+
+static size_t page_size(void)
+{
+  static size_t size;
+
+  if (size == 0)
+    size = (size_t) sysconf(_SC_PAGESIZE);
+
+  return size;
+}
+
+static size_t round_to_pages(size_t size)
+{
+  size_t page = page_size();
+
+  return (size + page - 1) / page * page;
+}
+
+void secret_wipe(void *memory, size_t size)
+{
+  volatile unsigned char *p = memory;
+
+  while (size-- > 0)
+    *p++ = 0;
+}
+
+void *secret_map(size_t size)
+{
+  size_t page = page_size();
+  char *mapping;
+
+  size = round_to_pages(size);
+
+  mapping = mmap(NULL, size + 2 * page, PROT_NONE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (mapping == MAP_FAILED)
+    return NULL;
+
+  if (mprotect(mapping + page, size, PROT_READ | PROT_WRITE) < 0) {
+    int errsv = errno;
+    (void) munmap(mapping, size + 2 * page);
+    errno = errsv;
+    return NULL;
+  }
+
+  /* Without the privilege or with a low limit the memory may still be
+   * swapped.  That is not a reason to refuse authentication. */
+  if (mlock(mapping + page, size) < 0)
+    g_debug("could not lock secret memory: %s", g_strerror(errno));
+
+#ifdef MADV_DONTDUMP
+  (void) madvise(mapping + page, size, MADV_DONTDUMP);
+#endif
+
+  return mapping + page;
+}
+
+void secret_unmap(void *memory, size_t size)
+{
+  size_t page = page_size();
+
+  if (memory == NULL)
+    return;
+
+  size = round_to_pages(size);
+  secret_wipe(memory, size);
+  (void) munlock(memory, size);
+  (void) munmap((char *) memory - page, size + 2 * page);
+}
+
+G_LOCK_DEFINE_STATIC(arena);
+
+/* The header of a block of the arena.  Its size is a multiple of the
+ * alignment so that the secret after it is aligned, too. */
+struct block
+{
+  /* The size of the block including the header. */
+  size_t size;
+  bool used;
+} __attribute__((aligned(SECRET_ALIGNMENT)));
+
+static struct
+{
+  char *memory;
+  /* The end of the last block. */
+  size_t end;
+} arena;
+
+#define block_at(offset) ((struct block *) (arena.memory + (offset)))
+
+void *secret_alloc(size_t size)
+{
+  void *secret = NULL;
+  size_t offset;
+
+  size = (size + SECRET_ALIGNMENT - 1) / SECRET_ALIGNMENT * SECRET_ALIGNMENT;
+  size += sizeof (struct block);
+
+  G_LOCK(arena);
+
+  if (arena.memory == NULL)
+    arena.memory = secret_map(SECRET_ARENA_SIZE);
+
+  if (arena.memory == NULL)
+    goto out;
+
+  /* Take the first free block that is large enough. */
+  for (offset = 0; offset < arena.end; offset += block_at(offset)->size)
+    if (!block_at(offset)->used && block_at(offset)->size >= size)
+      break;
+
+  if (offset == arena.end) {
+    if (size > SECRET_ARENA_SIZE - arena.end) {
+      errno = ENOMEM;
+      goto out;
+    }
+
+    block_at(offset)->size = size;
+    arena.end += size;
+  } else if (block_at(offset)->size - size >= 2 * sizeof (struct block)) {
+    /* Split off the rest. */
+    block_at(offset + size)->size = block_at(offset)->size - size;
+    block_at(offset + size)->used = false;
+    block_at(offset)->size = size;
+  }
+
+  block_at(offset)->used = true;
+
+  /* The memory is zero because it is wiped when it is given back. */
+  secret = block_at(offset) + 1;
+
+out:
+  G_UNLOCK(arena);
+
+  return secret;
+}
+
+void secret_free(void *secret)
+{
+  struct block *block;
+  size_t offset = 0;
+  size_t last_used = 0;
+
+  if (secret == NULL)
+    return;
+
+  block = (struct block *) secret - 1;
+
+  G_LOCK(arena);
+
+  g_assert((char *) block >= arena.memory &&
+           (char *) block < arena.memory + arena.end);
+  g_assert(block->used);
+
+  secret_wipe(secret, block->size - sizeof (struct block));
+  block->used = false;
+
+  /* Merge adjacent free blocks and drop those at the end. */
+  while (offset < arena.end) {
+    struct block *current = block_at(offset);
+
+    while (!current->used &&
+           offset + current->size < arena.end &&
+           !block_at(offset + current->size)->used) {
+      struct block *next = block_at(offset + current->size);
+
+      current->size += next->size;
+      secret_wipe(next, sizeof (struct block));
+    }
+
+    offset += current->size;
+
+    if (current->used)
+      last_used = offset;
+  }
+
+  if (last_used < arena.end) {
+    secret_wipe(block_at(last_used), sizeof (struct block));
+    arena.end = last_used;
+  }
+
+  G_UNLOCK(arena);
+}
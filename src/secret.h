@@ -0,0 +1,40 @@
+/* secret.h -- header for the secret memory of vlock,
+ *             the VT locking program for linux
+ *
+ * This program is copyright (C) 2007 Frank Benkstein, and is free
+ * software which is freely distributable under the terms of the
+ * GNU General Public License version 2, included as the file COPYING in this
+ * distribution.  It is NOT public domain software, and any
+ * redistribution not permitted by the GNU General Public License is
+ * expressly forbidden without prior written permission from
+ * the author.
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+/* Map memory for holding secrets.  The size is rounded up to whole pages.
+ * The pages are locked into memory if possible, excluded from core dumps and
+ * surrounded by inaccessible guard pages.  Returns NULL and sets errno on
+ * failure. */
+void *secret_map(size_t size);
+
+/* Wipe and unmap memory that was returned by secret_map() with the same
+ * size. */
+void secret_unmap(void *memory, size_t size);
+
+/* Clear memory in a way the compiler may not optimize away, e.g. right before
+ * it is freed or goes out of scope. */
+void secret_wipe(void *memory, size_t size);
+
+/* Allocate zeroed memory for a secret like a password from the secret arena.
+ * Returns NULL and sets errno if the arena could not be mapped or is
+ * exhausted.  Safe to call from any thread. */
+void *secret_alloc(size_t size);
+
+/* Give back memory allocated with secret_alloc().  NULL is ignored.  The
+ * memory is wiped and may be reused right away regardless of other secrets
+ * that are still allocated. */
+void secret_free(void *secret);
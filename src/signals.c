@@ -2,11 +2,13 @@
 #include <stdio.h>
 
 #include <signal.h>
+#include <pthread.h>
 
 #include <string.h>
 
 #include "signals.h"
 #include "util.h"
+#include "loop.h"
 
 static const char *termination_blurb =
   "\n"
@@ -26,6 +28,9 @@ static const char *termination_blurb =
 
 static void terminate(int signum)
 {
+  struct sigaction sa;
+  sigset_t mask;
+
   vlock_invoke_atexit();
 
   fprintf(stderr, "vlock: Killed by signal %d (%s)!\n", signum,
@@ -34,6 +39,17 @@ static void terminate(int signum)
   if (signum != SIGTERM)
     fputs(termination_blurb, stderr);
 
+  /* Die from the signal.  It is blocked if it came through the event
+   * loop. */
+  (void) sigemptyset(&(sa.sa_mask));
+  sa.sa_flags = 0;
+  sa.sa_handler = SIG_DFL;
+  (void) sigaction(signum, &sa, NULL);
+
+  (void) sigemptyset(&mask);
+  (void) sigaddset(&mask, signum);
+  (void) pthread_sigmask(SIG_UNBLOCK, &mask, NULL);
+
   raise(signum);
 }
 
@@ -49,13 +65,15 @@ void install_signal_handlers(void)
 
   /* Handle termination signals.  None of these should be delivered in a normal
    * run of the program because terminal signals (INT, QUIT) are disabled
-   * below. */
+   * below.  They are handled by the event loop once it is started. */
+  loop_handle_signal(SIGINT, terminate);
+  loop_handle_signal(SIGQUIT, terminate);
+  loop_handle_signal(SIGTERM, terminate);
+  loop_handle_signal(SIGHUP, terminate);
+
+  /* Faults must be handled right away. */
   sa.sa_flags = SA_RESETHAND;
   sa.sa_handler = terminate;
-  (void) sigaction(SIGINT, &sa, NULL);
-  (void) sigaction(SIGQUIT, &sa, NULL);
-  (void) sigaction(SIGTERM, &sa, NULL);
-  (void) sigaction(SIGHUP, &sa, NULL);
   (void) sigaction(SIGABRT, &sa, NULL);
   (void) sigaction(SIGSEGV, &sa, NULL);
 }
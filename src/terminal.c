@@ -1,24 +1,102 @@
+#include <stdbool.h>
 #include <unistd.h>
 #include <termios.h>
 
+#include <glib.h>
+
 #include "terminal.h"
 
-static struct termios term;
-static tcflag_t lflag;
+#define MAX_TERMINAL_MODES 8
+
+static struct
+{
+  int fd;
+  /* Whether the attributes below were read from the terminal. */
+  bool known;
+  /* The attributes the terminal had before. */
+  struct termios saved;
+  /* The attributes that were set last. */
+  struct termios current;
+  /* The local modes switched off by each mode on the stack. */
+  tcflag_t modes[MAX_TERMINAL_MODES];
+  size_t depth;
+} terminal = {
+  .fd = STDIN_FILENO,
+};
+
+void set_terminal(int fd)
+{
+  terminal.fd = fd;
+  terminal.known = false;
+  terminal.depth = 0;
+}
+
+static bool load_terminal(void)
+{
+  if (!terminal.known && tcgetattr(terminal.fd, &terminal.saved) == 0) {
+    terminal.current = terminal.saved;
+    terminal.known = true;
+  }
+
+  return terminal.known;
+}
+
+void push_terminal_mode(tcflag_t off)
+{
+  g_assert(terminal.depth < MAX_TERMINAL_MODES);
+  terminal.modes[terminal.depth++] = off;
+}
+
+void pop_terminal_mode(void)
+{
+  g_assert(terminal.depth > 0);
+  terminal.depth--;
+}
+
+bool apply_terminal_mode(void)
+{
+  struct termios term;
+  tcflag_t off = 0;
+
+  if (!load_terminal())
+    return false;
+
+  for (size_t i = 0; i < terminal.depth; i++)
+    off |= terminal.modes[i];
+
+  term = terminal.saved;
+  term.c_lflag &= ~off;
+
+  if ((off & ICANON) != 0) {
+    term.c_cc[VMIN] = 1;
+    term.c_cc[VTIME] = 0;
+  }
+
+  if (term.c_lflag == terminal.current.c_lflag &&
+      term.c_cc[VMIN] == terminal.current.c_cc[VMIN] &&
+      term.c_cc[VTIME] == terminal.current.c_cc[VTIME])
+    return false;
+
+  /* Neither wait for pending output nor discard input.  Both are done
+   * explicitly where needed. */
+  if (tcsetattr(terminal.fd, TCSANOW, &term) < 0)
+    return false;
+
+  terminal.current = term;
+
+  return true;
+}
 
 void secure_terminal(void)
 {
   /* Disable terminal echoing and signals. */
-  (void) tcgetattr(STDIN_FILENO, &term);
-  lflag = term.c_lflag;
-  term.c_lflag &= ~(ECHO | ISIG);
-  (void) tcsetattr(STDIN_FILENO, TCSANOW, &term);
+  push_terminal_mode(ECHO | ISIG);
+  (void) apply_terminal_mode();
 }
 
 void restore_terminal(void)
 {
   /* Restore the terminal. */
-  term.c_lflag = lflag;
-  (void) tcsetattr(STDIN_FILENO, TCSANOW, &term);
+  terminal.depth = 0;
+  (void) apply_terminal_mode();
 }
-
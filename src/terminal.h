@@ -1,2 +1,31 @@
+#pragma once
+
+#include <stdbool.h>
+#include <termios.h>
+
+/* The terminal is controlled through a stack of modes.  Each mode switches
+ * off some local modes (c_lflag) in addition to the modes below it.  Changes
+ * of the stack are collected and only applied when the terminal is used so
+ * that popping a mode and pushing the same one again costs nothing. */
+
+/* Use the given file descriptor instead of stdin.  Resets the stack and
+ * forgets the saved attributes. */
+void set_terminal(int fd);
+
+/* Switch off the given local modes.  If ICANON is among them every character
+ * is made available as soon as it is typed. */
+void push_terminal_mode(tcflag_t off);
+
+/* Undo the last push_terminal_mode(). */
+void pop_terminal_mode(void);
+
+/* Bring the terminal into the mode on top of the stack.  The attributes are
+ * only set if they differ from the ones set last.  Returns true if they were
+ * set. */
+bool apply_terminal_mode(void);
+
+/* Disable terminal echoing and signals immediately. */
 void secure_terminal(void);
+
+/* Pop all modes and restore the attributes the terminal had before. */
 void restore_terminal(void);
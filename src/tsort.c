@@ -11,102 +11,300 @@
  */
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <errno.h>
 
 #include "util.h"
 
 #include "tsort.h"
 
-/* Get the zeros of the graph, i.e. nodes with no incoming edges. */
-static GList *get_zeros(GList *nodes, GList *edges)
+/* The graph in a form suitable for sorting.  Nodes and edges are referred to
+ * by their index in the given lists.  The outgoing edges of node i are
+ * adjacency[first_edge[i]] to adjacency[first_edge[i+1]-1], in the order they
+ * were given. */
+struct graph
 {
-  GList *zeros = g_list_copy(nodes);
+  size_t nr_nodes;
+  size_t nr_edges;
 
-  for (GList *edge_item = edges;
-       edge_item != NULL;
-       edge_item = g_list_next(edge_item)) {
-    struct edge *e = edge_item->data;
-    zeros = g_list_remove(zeros, e->successor);
+  void **nodes;
+  struct edge **edges;
+
+  /* Node indices of each edge's ends or nr_nodes if the node is unknown. */
+  size_t *predecessors;
+  size_t *successors;
+
+  size_t *first_edge;
+  size_t *adjacency;
+
+  /* Number of incoming edges of each node. */
+  size_t *in_degree;
+};
+
+static void init_graph(struct graph *g, GList *nodes, GList *edges)
+{
+  GHashTable *node_indices = g_hash_table_new(g_direct_hash, g_direct_equal);
+  size_t i;
+
+  g->nr_nodes = g_list_length(nodes);
+  g->nr_edges = g_list_length(edges);
+
+  g->nodes = g_new(void *, g->nr_nodes);
+  g->edges = g_new(struct edge *, g->nr_edges);
+  g->predecessors = g_new(size_t, g->nr_edges);
+  g->successors = g_new(size_t, g->nr_edges);
+  g->first_edge = g_new0(size_t, g->nr_nodes + 1);
+  g->adjacency = g_new(size_t, g->nr_edges);
+  g->in_degree = g_new0(size_t, g->nr_nodes);
+
+  /* Indices are stored off by one to tell index 0 from a missing node. */
+  i = 0;
+
+  for (GList *item = nodes; item != NULL; item = g_list_next(item), i++) {
+    g->nodes[i] = item->data;
+
+    if (g_hash_table_lookup(node_indices, item->data) == NULL)
+      g_hash_table_insert(node_indices, item->data, GSIZE_TO_POINTER(i + 1));
+  }
+
+  i = 0;
+
+  for (GList *item = edges; item != NULL; item = g_list_next(item), i++) {
+    struct edge *e = item->data;
+    size_t p = GPOINTER_TO_SIZE(g_hash_table_lookup(node_indices,
+                                                    e->predecessor));
+    size_t s = GPOINTER_TO_SIZE(g_hash_table_lookup(node_indices,
+                                                    e->successor));
+
+    g->edges[i] = e;
+    g->predecessors[i] = (p > 0) ? p - 1 : g->nr_nodes;
+    g->successors[i] = (s > 0) ? s - 1 : g->nr_nodes;
+
+    /* Count the outgoing edges of each node first. */
+    if (p > 0 && s > 0) {
+      g->first_edge[p]++;
+      g->in_degree[s - 1]++;
+    }
   }
 
-  return zeros;
+  g_hash_table_destroy(node_indices);
+
+  /* Turn the counts into offsets.  first_edge[i+1] is then the end of the
+   * edges of node i. */
+  for (i = 0; i < g->nr_nodes; i++)
+    g->first_edge[i + 1] += g->first_edge[i];
+
+  /* Fill in the edges of each node in their original order.  first_edge[i] is
+   * used as the insertion point and restored afterwards. */
+  for (i = 0; i < g->nr_edges; i++) {
+    size_t p = g->predecessors[i];
+
+    if (p < g->nr_nodes && g->successors[i] < g->nr_nodes)
+      g->adjacency[g->first_edge[p]++] = i;
+  }
+
+  for (i = g->nr_nodes; i > 0; i--)
+    g->first_edge[i] = g->first_edge[i - 1];
+
+  g->first_edge[0] = 0;
+}
+
+static void clear_graph(struct graph *g)
+{
+  g_free(g->nodes);
+  g_free(g->edges);
+  g_free(g->predecessors);
+  g_free(g->successors);
+  g_free(g->first_edge);
+  g_free(g->adjacency);
+  g_free(g->in_degree);
+}
+
+/* Remove the given node from the nodes that are left with incoming edges
+ * together with all nodes that are left without incoming edges because of
+ * this.  Such nodes cannot be on a circle anymore.  The stack must have room
+ * for all nodes. */
+static void remove_node(struct graph *g, size_t node, size_t *stack)
+{
+  size_t top = 0;
+
+  g->in_degree[node] = 0;
+  stack[top++] = node;
+
+  while (top > 0) {
+    size_t n = stack[--top];
+
+    for (size_t j = g->first_edge[n]; j < g->first_edge[n + 1]; j++) {
+      size_t s = g->successors[g->adjacency[j]];
+
+      if (g->in_degree[s] > 0 && --g->in_degree[s] == 0)
+        stack[top++] = s;
+    }
+  }
 }
 
-/* Check if the given node is a zero. */
-static bool is_zero(void *node, GList *edges)
+/* Find the shortest circle through the nodes that are left with incoming
+ * edges.  Returns its length and stores its edge indices in circle.
+ *
+ * A breadth first search is started from each node.  Afterwards the node is
+ * removed because all circles through it are known, and so are the nodes that
+ * are then left without incoming edges.  A single large circle thus
+ * takes linear time, but in general finding the shortest circle takes
+ * O(V * (V + E)) time.  This is only done to report an error.  The incoming
+ * edges of the nodes are used up. */
+static size_t find_shortest_circle(struct graph *g, size_t *circle)
 {
-  for (GList *edge_item = edges;
-       edge_item != NULL;
-       edge_item = g_list_next(edge_item)) {
-    struct edge *e = edge_item->data;
+  size_t *distance = g_new(size_t, g->nr_nodes);
+  size_t *parent_edge = g_new(size_t, g->nr_nodes);
+  size_t *queue = g_new(size_t, g->nr_nodes);
+  size_t best_length = 0;
+
+  for (size_t start = 0; start < g->nr_nodes; start++) {
+    size_t head = 0;
+    size_t tail = 0;
+    size_t closing_edge = g->nr_edges;
+
+    if (g->in_degree[start] == 0)
+      continue;
+
+    for (size_t i = 0; i < g->nr_nodes; i++)
+      distance[i] = SIZE_MAX;
+
+    distance[start] = 0;
+    queue[tail++] = start;
+
+    /* Breadth first search that stops at the first edge back to the start or
+     * when no shorter circle can be found anymore. */
+    while (head < tail && closing_edge == g->nr_edges) {
+      size_t node = queue[head++];
+
+      if (best_length > 0 && distance[node] + 1 >= best_length)
+        break;
+
+      for (size_t j = g->first_edge[node]; j < g->first_edge[node + 1]; j++) {
+        size_t e = g->adjacency[j];
+        size_t s = g->successors[e];
+
+        if (g->in_degree[s] == 0)
+          continue;
+
+        if (s == start) {
+          closing_edge = e;
+          break;
+        }
+
+        if (distance[s] == SIZE_MAX) {
+          distance[s] = distance[node] + 1;
+          parent_edge[s] = e;
+          queue[tail++] = s;
+        }
+      }
+    }
+
+    if (closing_edge != g->nr_edges) {
+      /* Walk back from the closing edge to the start. */
+      best_length = distance[g->predecessors[closing_edge]] + 1;
+      circle[best_length - 1] = closing_edge;
 
-    if (e->successor == node)
-      return false;
+      for (size_t i = best_length - 1, node = g->predecessors[closing_edge];
+           i > 0;
+           i--, node = g->predecessors[parent_edge[node]])
+        circle[i - 1] = parent_edge[node];
+    }
+
+    /* The queue is free again. */
+    remove_node(g, start, queue);
   }
 
-  return true;
+  g_free(queue);
+  g_free(parent_edge);
+  g_free(distance);
+
+  return best_length;
 }
 
 /* For the given directed graph, generate a topological sort of the nodes.
  *
- * Sorts the list and deletes all edges.  If there are circles found in the
- * graph or there are edges that have no corresponding nodes the erroneous
- * edges are left.
- *
- * The algorithm is taken from the Wikipedia:
- *
- * http://en.wikipedia.org/w/index.php?title=Topological_sorting&oldid=153157450#Algorithms
+ * Sorts the list and deletes all edges.  If there are edges that have no
+ * corresponding nodes those edges are left.  Otherwise if there are circles
+ * in the graph the edges of one of the shortest circles are left, in the
+ * order they form the circle.
  *
+ * This is Kahn's algorithm.  Nodes without incoming edges are sorted in the
+ * order of the given list, the successors of each node in the order of the
+ * given edges.  It runs in time linear to the number of nodes and edges.
  */
 GList *tsort(GList *nodes, GList **edges)
 {
-  /* Retrieve all zeros. */
-  GList *zeros = get_zeros(nodes, *edges);
-
+  struct graph g;
   GList *sorted_nodes = NULL;
+  GList *left_edges = NULL;
+  bool *left;
+  size_t *queue;
+  size_t head = 0;
+  size_t tail = 0;
 
-  /* While the list of zeros is not empty ... */
-  while (zeros != NULL) {
-    /* ... take the first zero and remove it and ...*/
-    void *zero = zeros->data;
-    zeros = g_list_delete_link(zeros, zeros);
+  init_graph(&g, nodes, *edges);
 
-    /* ... add it to the list of sorted nodes. */
-    sorted_nodes = g_list_append(sorted_nodes, zero);
+  left = g_new0(bool, g.nr_edges);
 
-    /* Then look at each edge ... */
-    for (GList *edge_item = *edges;
-         edge_item != NULL;) {
-      struct edge *e = edge_item->data;
+  /* Edges with unknown nodes cannot be sorted. */
+  for (size_t i = g.nr_edges; i > 0; i--)
+    if (g.predecessors[i - 1] == g.nr_nodes ||
+        g.successors[i - 1] == g.nr_nodes) {
+      left[i - 1] = true;
+      left_edges = g_list_prepend(left_edges, g.edges[i - 1]);
+    }
 
-      GList *tmp = g_list_next(edge_item);
+  queue = g_new(size_t, g.nr_nodes);
 
-      /* ... that has this zero as its predecessor ... */
-      if (e->predecessor == zero) {
-        /* ... and remove it. */
-        *edges = g_list_delete_link(*edges, edge_item);
+  /* Start with the zeros of the graph, i.e. nodes with no incoming edges. */
+  for (size_t i = 0; i < g.nr_nodes; i++)
+    if (g.in_degree[i] == 0)
+      queue[tail++] = i;
 
-        /* If the successor has become a zero now ... */
-        if (is_zero(e->successor, *edges))
-          /* ... add it to the list of zeros. */
-          zeros = g_list_append(zeros, e->successor);
+  /* Take each zero and remove its outgoing edges.  Successors that become
+   * zeros are added to the end of the queue. */
+  while (head < tail) {
+    size_t node = queue[head++];
 
-        g_free(e);
-      }
+    for (size_t j = g.first_edge[node]; j < g.first_edge[node + 1]; j++) {
+      size_t s = g.successors[g.adjacency[j]];
 
-      edge_item = tmp;
+      if (--g.in_degree[s] == 0)
+        queue[tail++] = s;
     }
   }
 
-  /* If all edges were deleted the algorithm was successful. */
-  if (*edges != NULL) {
-    g_list_free(sorted_nodes);
-    sorted_nodes = NULL;
+  if (left_edges == NULL && tail < g.nr_nodes) {
+    size_t *circle = g_new(size_t, g.nr_nodes);
+    size_t length = find_shortest_circle(&g, circle);
+
+    for (size_t i = length; i > 0; i--) {
+      left[circle[i - 1]] = true;
+      left_edges = g_list_prepend(left_edges, g.edges[circle[i - 1]]);
+    }
+
+    g_free(circle);
+  }
+
+  if (left_edges == NULL) {
+    /* The queue now holds all nodes in sorted order. */
+    for (size_t i = tail; i > 0; i--)
+      sorted_nodes = g_list_prepend(sorted_nodes, g.nodes[queue[i - 1]]);
   }
 
-  g_list_free(zeros);
+  /* Delete all edges that are not left. */
+  for (size_t i = 0; i < g.nr_edges; i++)
+    if (!left[i])
+      g_free(g.edges[i]);
+
+  g_list_free(*edges);
+  *edges = left_edges;
+
+  g_free(left);
+  g_free(queue);
+  clear_graph(&g);
 
   return sorted_nodes;
-  ;
 }
-
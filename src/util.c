@@ -79,3 +79,68 @@ void vlock_atexit(void (*function)(void))
   atexit_functions = g_list_prepend(atexit_functions, p.as_pointer);
 }
 
+struct ring_buffer *ring_buffer_new(size_t size)
+{
+  struct ring_buffer *buffer = g_new(struct ring_buffer, 1);
+
+  buffer->data = g_malloc(size);
+  buffer->size = size;
+  buffer->start = 0;
+  buffer->length = 0;
+  buffer->dropped = 0;
+
+  return buffer;
+}
+
+void ring_buffer_free(struct ring_buffer *buffer)
+{
+  g_free(buffer->data);
+  g_free(buffer);
+}
+
+void ring_buffer_append(struct ring_buffer *buffer,
+                        const char *data,
+                        size_t length)
+{
+  size_t end;
+  size_t first;
+
+  /* Only the tail of data fits. */
+  if (length > buffer->size) {
+    buffer->dropped += length - buffer->size;
+    data += length - buffer->size;
+    length = buffer->size;
+  }
+
+  /* Make room by dropping the oldest data. */
+  if (buffer->length + length > buffer->size) {
+    size_t overflow = buffer->length + length - buffer->size;
+
+    buffer->dropped += overflow;
+    buffer->start = (buffer->start + overflow) % buffer->size;
+    buffer->length -= overflow;
+  }
+
+  if (length == 0)
+    return;
+
+  end = (buffer->start + buffer->length) % buffer->size;
+  first = MIN(length, buffer->size - end);
+
+  memcpy(buffer->data + end, data, first);
+  memcpy(buffer->data, data + first, length - first);
+
+  buffer->length += length;
+}
+
+char *ring_buffer_dup(const struct ring_buffer *buffer)
+{
+  char *result = g_malloc(buffer->length + 1);
+  size_t first = MIN(buffer->length, buffer->size - buffer->start);
+
+  memcpy(result, buffer->data + buffer->start, first);
+  memcpy(result + first, buffer->data, buffer->length - first);
+  result[buffer->length] = '\0';
+
+  return result;
+}
@@ -11,6 +11,8 @@
  *
  */
 
+#pragma once
+
 #include <stddef.h>
 
 struct timespec;
@@ -24,6 +26,31 @@ struct timespec *parse_seconds(const char *s);
 void vlock_invoke_atexit(void);
 void vlock_atexit(void (*function)(void));
 
+/* A buffer of fixed size that keeps the data that was appended last. */
+struct ring_buffer
+{
+  char *data;
+  size_t size;
+  /* Offset of the oldest byte. */
+  size_t start;
+  size_t length;
+  /* How many bytes were overwritten. */
+  size_t dropped;
+};
+
+struct ring_buffer *ring_buffer_new(size_t size);
+void ring_buffer_free(struct ring_buffer *buffer);
+
+/* Append the given data.  The oldest data is overwritten if the buffer is
+ * full. */
+void ring_buffer_append(struct ring_buffer *buffer,
+                        const char *data,
+                        size_t length);
+
+/* Copy the contents oldest first into a new nul-terminated string that
+ * should be freed with g_free(). */
+char *ring_buffer_dup(const struct ring_buffer *buffer);
+
 #define STRERROR (errno ? strerror(errno) : "Unknown error")
 
 #define GUARD_ERRNO(expr) \
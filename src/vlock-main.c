@@ -34,10 +34,14 @@
 #include "terminal.h"
 #include "util.h"
 #include "logging.h"
+#include "loop.h"
+#include "secret.h"
 
 #ifdef USE_PLUGINS
 #include "plugins.h"
 #include "plugin.h"
+#include "script.h"
+#include "process.h"
 #endif
 
 static const char *auth_failure_blurb =
@@ -52,12 +56,66 @@ static const char *auth_failure_blurb =
 
 static int auth_tries;
 
+/* Set up the timeout for one authentication.  The limit applies to each
+ * authentication as a whole. */
+static void start_timeout(struct prompt_timeout *timeout,
+                          const struct timespec *inactivity,
+                          const struct timespec *limit)
+{
+  timeout->inactivity = inactivity;
+  timeout->deadline = 0;
+
+  if (limit != NULL)
+    timeout->deadline = g_get_monotonic_time() +
+                        (gint64) limit->tv_sec * G_USEC_PER_SEC;
+}
+
+/* Prompt for a single password and check it against all of the given users
+ * at the same time. */
+static bool auth_single_prompt(const char *const users[],
+                               const struct prompt_timeout *timeout,
+                               GError **error)
+{
+  char *password = prompt_echo_off("Password: ", timeout, error);
+  bool result;
+
+  if (password == NULL)
+    return false;
+
+  result = auth_any(users, password, timeout, error);
+  secret_free(password);
+
+  return result;
+}
+
+/* Tell the user why the authentication failed. */
+static void report_auth_error(const GError *err)
+{
+  if (g_error_matches(err,
+                      VLOCK_PROMPT_ERROR,
+                      VLOCK_PROMPT_ERROR_TIMEOUT))
+    fprintf(stderr, "Timeout!\n");
+  else {
+    fprintf(stderr, "vlock: %s\n", err->message);
+
+    if (g_error_matches(err,
+                        VLOCK_AUTH_ERROR,
+                        VLOCK_AUTH_ERROR_FAILED)) {
+      fputs(auth_failure_blurb, stderr);
+      sleep(3);
+    }
+  }
+}
+
 static void auth_loop(const char *username)
 {
   GError *err = NULL;
   struct timespec *prompt_timeout;
+  struct timespec *prompt_limit;
   struct timespec *wait_timeout;
   char *vlock_message;
+  char *type_ahead;
+  char *single_prompt;
   const char *auth_names[] = { username, "root", NULL };
 
   /* If NO_ROOT_PASS is defined or the username is "root" ... */
@@ -79,6 +137,22 @@ static void auth_loop(const char *username)
 
   /* Get the timeouts from the environment. */
   prompt_timeout = parse_seconds(getenv("VLOCK_PROMPT_TIMEOUT"));
+  prompt_limit = parse_seconds(getenv("VLOCK_PROMPT_LIMIT"));
+
+  /* Keys typed before the prompt appears are part of the password. */
+  type_ahead = getenv("VLOCK_TYPE_AHEAD");
+
+  if (type_ahead != NULL && *type_ahead != '\0')
+    keep_type_ahead(true);
+  else
+    type_ahead = NULL;
+
+  /* Check one password against all users instead of prompting for each. */
+  single_prompt = getenv("VLOCK_SINGLE_PROMPT");
+
+  if (single_prompt != NULL && *single_prompt == '\0')
+    single_prompt = NULL;
+
 #ifdef USE_PLUGINS
   wait_timeout = parse_seconds(getenv("VLOCK_TIMEOUT"));
 #else
@@ -94,16 +168,25 @@ static void auth_loop(const char *username)
       fputc('\n', stderr);
     }
 
-    /* Wait for enter or escape to be pressed. */
-    c = wait_for_character("\n\033", wait_timeout, NULL);
+    if (type_ahead != NULL) {
+      /* Wait for the first key.  Unless it is enter or escape it stays in the
+       * buffer as the start of the password. */
+      c = peek_character(wait_timeout, NULL);
+
+      if (c == '\n' || c == '\033')
+        (void) read_character(NULL, NULL);
+    } else {
+      /* Wait for enter or escape to be pressed. */
+      c = wait_for_character("\n\033", wait_timeout, NULL);
+    }
 
     /* Escape was pressed or the timeout occurred. */
     if (c == '\033' || c == 0) {
 #ifdef USE_PLUGINS
-      plugin_hook("vlock_save");
+      plugin_hook(HOOK_VLOCK_SAVE);
       /* Wait for any key to be pressed. */
       c = wait_for_character(NULL, NULL, NULL);
-      plugin_hook("vlock_save_abort");
+      plugin_hook(HOOK_VLOCK_SAVE_ABORT);
 
       /* Do not require enter to be pressed twice. */
       if (c != '\n')
@@ -113,29 +196,33 @@ static void auth_loop(const char *username)
 #endif
     }
 
-    for (size_t i = 0; auth_names[i] != NULL; i++) {
-      if (auth(auth_names[i], prompt_timeout, &err))
-        goto auth_success;
+    /* Only useful if there is more than one user to check. */
+    if (single_prompt != NULL && auth_names[1] != NULL) {
+      struct prompt_timeout timeout;
 
-      g_assert(err != NULL);
+      start_timeout(&timeout, prompt_timeout, prompt_limit);
 
-      if (g_error_matches(err,
-                          VLOCK_PROMPT_ERROR,
-                          VLOCK_PROMPT_ERROR_TIMEOUT))
-        fprintf(stderr, "Timeout!\n");
-      else {
-        fprintf(stderr, "vlock: %s\n", err->message);
-
-        if (g_error_matches(err,
-                            VLOCK_AUTH_ERROR,
-                            VLOCK_AUTH_ERROR_FAILED)) {
-          fputs(auth_failure_blurb, stderr);
-          sleep(3);
-        }
-      }
+      if (auth_single_prompt(auth_names, &timeout, &err))
+        goto auth_success;
 
+      g_assert(err != NULL);
+      report_auth_error(err);
       g_clear_error(&err);
       sleep(1);
+    } else {
+      for (size_t i = 0; auth_names[i] != NULL; i++) {
+        struct prompt_timeout timeout;
+
+        start_timeout(&timeout, prompt_timeout, prompt_limit);
+
+        if (auth_in_worker(auth_names[i], &timeout, &err))
+          goto auth_success;
+
+        g_assert(err != NULL);
+        report_auth_error(err);
+        g_clear_error(&err);
+        sleep(1);
+      }
     }
 
     auth_tries++;
@@ -145,6 +232,7 @@ auth_success:
   /* Free timeouts memory. */
   free(wait_timeout);
   free(prompt_timeout);
+  free(prompt_limit);
 }
 
 void display_auth_tries(void)
@@ -159,7 +247,102 @@ void display_auth_tries(void)
 #ifdef USE_PLUGINS
 static void call_end_hook(void)
 {
-  (void) plugin_hook("vlock_end");
+  (void) plugin_hook(HOOK_VLOCK_END);
+}
+
+static bool reap_plugin_children(int __attribute__((unused)) fd,
+                                 void __attribute__((unused)) *data)
+{
+  reap_children();
+  return true;
+}
+
+/* Load the named plugins and resolve their dependencies.  Exits on failure. */
+static void load_plugins(char *const names[], size_t nr_names)
+{
+  GError *tmp_error = NULL;
+
+  preload_plugins(names, nr_names);
+
+  for (size_t i = 0; i < nr_names; i++) {
+    if (!load_plugin(names[i], &tmp_error)) {
+      g_assert(tmp_error != NULL);
+
+      if (g_error_matches(tmp_error,
+                          VLOCK_PLUGIN_ERROR,
+                          VLOCK_PLUGIN_ERROR_NOT_FOUND))
+        g_fprintf(stderr, "vlock: no such plugin '%s'\n", names[i]);
+      else
+        g_fprintf(stderr,
+                  "vlock: loading plugin '%s' failed: %s\n",
+                  names[i],
+                  tmp_error->message);
+
+      g_clear_error(&tmp_error);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if (!resolve_dependencies(&tmp_error)) {
+    g_assert(tmp_error != NULL);
+    g_fprintf(stderr,
+              "vlock: error resolving plugin dependencies: %s\n",
+              tmp_error->message);
+    g_clear_error(&tmp_error);
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* Probe the named scripts, or all scripts if none are named, and store their
+ * dependencies in the cache.  Only root may do this because the cache is not
+ * written for other users.  Exits when done. */
+static void update_cache(char *const names[], size_t nr_names)
+{
+  GError *tmp_error = NULL;
+  gchar **all_names = NULL;
+  bool failed = false;
+
+  if (getuid() != 0) {
+    g_fprintf(stderr, "vlock: only root may update the dependency cache\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (nr_names == 0) {
+    all_names = vlock_script_list_all(&tmp_error);
+
+    if (all_names == NULL) {
+      g_assert(tmp_error != NULL);
+      g_fprintf(stderr,
+                "vlock: could not list scripts: %s\n",
+                tmp_error->message);
+      g_clear_error(&tmp_error);
+      exit(EXIT_FAILURE);
+    }
+
+    names = all_names;
+    nr_names = g_strv_length(all_names);
+  }
+
+  /* Scripts whose dependencies are not cached yet are probed and the result
+   * is stored. */
+  preload_plugins(names, nr_names);
+
+  for (size_t i = 0; i < nr_names; i++) {
+    if (!load_plugin(names[i], &tmp_error)) {
+      g_assert(tmp_error != NULL);
+      g_fprintf(stderr,
+                "vlock: loading plugin '%s' failed: %s\n",
+                names[i],
+                tmp_error->message);
+      g_clear_error(&tmp_error);
+      failed = true;
+    }
+  }
+
+  unload_plugins();
+  g_strfreev(all_names);
+
+  exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
 }
 
 #endif
@@ -189,38 +372,72 @@ int main(int argc, char *const argv[])
 
 #ifdef USE_PLUGINS
   GError *tmp_error = NULL;
+  const char *plan_file;
 
-  for (int i = 1; i < argc; i++) {
-    if (!load_plugin(argv[i], &tmp_error)) {
-      g_assert(tmp_error != NULL);
+  start_supervisor();
 
-      if (g_error_matches(tmp_error,
-                          VLOCK_PLUGIN_ERROR,
-                          VLOCK_PLUGIN_ERROR_NOT_FOUND))
-        g_fprintf(stderr, "vlock: no such plugin '%s'\n", argv[i]);
-      else
-        g_fprintf(stderr,
-                  "vlock: loading plugin '%s' failed: %s\n",
-                  argv[i],
-                  tmp_error->message);
+  if (argc > 1 && strcmp(argv[1], "--update-cache") == 0)
+    update_cache(argv + 2, argc - 2);
+
+  if (argc > 2 && strcmp(argv[1], "--compile-plan") == 0) {
+    /* Plugins are only looked up here, nothing needs privileges. */
+    if (setgid(getgid()) < 0 || setuid(getuid()) < 0) {
+      g_fprintf(stderr,
+                "vlock: could not drop privileges: %s\n",
+                g_strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+
+    record_opened_plugins();
+    load_plugins(argv + 3, argc - 3);
+    vlock_atexit(unload_plugins);
 
+    if (!write_plan(argv[2], argv + 3, argc - 3, &tmp_error)) {
+      g_assert(tmp_error != NULL);
+      g_fprintf(stderr,
+                "vlock: could not compile plan: %s\n",
+                tmp_error->message);
       g_clear_error(&tmp_error);
       exit(EXIT_FAILURE);
     }
+
+    exit(EXIT_SUCCESS);
+  }
+#endif
+
+  /* From here on signals are handled by the event loop. */
+  loop_init();
+
+#ifdef USE_PLUGINS
+  /* Reap child processes of plugins as soon as they exit. */
+  if (get_supervisor_fd() >= 0)
+    (void) loop_watch_fd(get_supervisor_fd(), reap_plugin_children, NULL);
+
+  plan_file = g_getenv("VLOCK_PLAN");
+
+  /* Fall back to loading the plugins if the plan cannot be used. */
+  if (plan_file == NULL || *plan_file == '\0' ||
+      !load_plan(plan_file, argv + 1, argc - 1, &tmp_error)) {
+    if (tmp_error != NULL) {
+      g_debug("not using plan: %s", tmp_error->message);
+      g_clear_error(&tmp_error);
+    }
+
+    load_plugins(argv + 1, argc - 1);
   }
 
   vlock_atexit(unload_plugins);
 
-  if (!resolve_dependencies(&tmp_error)) {
+  if (!activate_plugins(&tmp_error)) {
     g_assert(tmp_error != NULL);
     g_fprintf(stderr,
-              "vlock: error resolving plugin dependencies: %s\n",
+              "vlock: activating plugins failed: %s\n",
               tmp_error->message);
     g_clear_error(&tmp_error);
     exit(EXIT_FAILURE);
   }
 
-  plugin_hook("vlock_start");
+  plugin_hook(HOOK_VLOCK_START);
   vlock_atexit(call_end_hook);
 #else /* !USE_PLUGINS */
   /* Emulate pseudo plugin "all". */
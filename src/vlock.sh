@@ -222,7 +222,8 @@ main() {
   done
 
   # Export variables for vlock-main.
-  export_if_set VLOCK_TIMEOUT VLOCK_PROMPT_TIMEOUT
+  export_if_set VLOCK_TIMEOUT VLOCK_PROMPT_TIMEOUT VLOCK_PROMPT_LIMIT
+  export_if_set VLOCK_PLAN VLOCK_DEBUG VLOCK_TYPE_AHEAD VLOCK_SINGLE_PROMPT
   export_if_set VLOCK_MESSAGE VLOCK_ALL_MESSAGE VLOCK_CURRENT_MESSAGE
 
   if [ "${VLOCK_ENABLE_PLUGINS}" = "yes" ] ; then
@@ -26,6 +26,32 @@ void test_wait_for_death(void)
   CU_ASSERT(wait_for_death(pid, 0, 20000));
 }
 
+void test_wait_for_deaths(void)
+{
+  pid_t pids[3];
+  bool dead[3] = { false, false, false };
+
+  for (size_t i = 0; i < 3; i++) {
+    pids[i] = fork();
+
+    if (pids[i] == 0) {
+      /* The last child outlives the deadline. */
+      usleep(i < 2 ? 20000 : 2000000);
+      _exit(0);
+    }
+  }
+
+  CU_ASSERT(!wait_for_deaths(pids, dead, 3, 0, 500000L));
+  CU_ASSERT(dead[0]);
+  CU_ASSERT(dead[1]);
+  CU_ASSERT(!dead[2]);
+
+  (void) kill(pids[2], SIGKILL);
+
+  CU_ASSERT(wait_for_deaths(pids, dead, 3, 0, 500000L));
+  CU_ASSERT(dead[2]);
+}
+
 void test_ensure_death(void)
 {
   pid_t pid = fork();
@@ -43,6 +69,31 @@ void test_ensure_death(void)
   CU_ASSERT(errno == ECHILD);
 }
 
+void test_ensure_deaths(void)
+{
+  pid_t pids[4];
+
+  for (size_t i = 0; i < 4; i++) {
+    pids[i] = fork();
+
+    if (pids[i] == 0) {
+      /* Half of the children need SIGKILL. */
+      if (i % 2)
+        signal(SIGTERM, SIG_IGN);
+
+      pause();
+      _exit(0);
+    }
+  }
+
+  ensure_deaths(pids, 4);
+
+  for (size_t i = 0; i < 4; i++) {
+    CU_ASSERT(waitpid(pids[i], NULL, WNOHANG) < 0);
+    CU_ASSERT(errno == ECHILD);
+  }
+}
+
 int child_function(void *a)
 {
   char *s = a;
@@ -136,10 +187,113 @@ void test_create_child_process(void)
   CU_ASSERT(wait_for_death(child.pid, 0, 0));
 }
 
+/* Check that no descriptors besides stdin, stdout and stderr are open. */
+int check_fds_closed(void __attribute__((unused)) *a)
+{
+  for (int fd = STDERR_FILENO + 1; fd < 1024; fd++)
+    if (fcntl(fd, F_GETFD) >= 0)
+      return 1;
+
+  return 0;
+}
+
+void test_create_child_closes_fds(void)
+{
+  struct child_process child = {
+    .function = check_fds_closed,
+    .stdin_fd = REDIRECT_DEV_NULL,
+    .stdout_fd = REDIRECT_DEV_NULL,
+    .stderr_fd = REDIRECT_DEV_NULL,
+  };
+  int fds[] = { 10, 100, 1000 };
+  int status;
+
+  for (size_t i = 0; i < sizeof fds / sizeof fds[0]; i++)
+    CU_ASSERT(dup2(STDIN_FILENO, fds[i]) == fds[i]);
+
+  CU_ASSERT(create_child(&child, NULL));
+
+  CU_ASSERT(waitpid(child.pid, &status, 0) == child.pid);
+  CU_ASSERT(WIFEXITED(status));
+  CU_ASSERT(WEXITSTATUS(status) == 0);
+
+  for (size_t i = 0; i < sizeof fds / sizeof fds[0]; i++)
+    (void) close(fds[i]);
+}
+
+int exit_with_argument(void *a)
+{
+  return GPOINTER_TO_INT(a);
+}
+
+void test_get_child_status(void)
+{
+  struct child_process child = {
+    .function = exit_with_argument,
+    .argument = GINT_TO_POINTER(7),
+    .stdin_fd = REDIRECT_DEV_NULL,
+    .stdout_fd = REDIRECT_DEV_NULL,
+    .stderr_fd = REDIRECT_DEV_NULL,
+    .name = "test",
+  };
+  int status;
+  struct rusage rusage;
+
+  CU_ASSERT(create_child(&child, NULL));
+
+  CU_ASSERT(wait_for_death(child.pid, 0, 500000L));
+
+  CU_ASSERT(get_child_status(child.pid, &status, &rusage));
+  CU_ASSERT(WIFEXITED(status));
+  CU_ASSERT(WEXITSTATUS(status) == 7);
+}
+
+int crash(void __attribute__((unused)) *a)
+{
+  (void) raise(SIGUSR1);
+  return 0;
+}
+
+void test_reap_children_restarts(void)
+{
+  struct child_process child = {
+    .function = crash,
+    .stdin_fd = REDIRECT_DEV_NULL,
+    .stdout_fd = REDIRECT_DEV_NULL,
+    .stderr_fd = REDIRECT_DEV_NULL,
+    .restart = true,
+  };
+  pid_t pid;
+  siginfo_t info;
+  int status;
+
+  CU_ASSERT(create_child(&child, NULL));
+  pid = child.pid;
+
+  /* Wait for the crash without reaping the child. */
+  CU_ASSERT(waitid(P_PID, pid, &info, WEXITED | WNOWAIT) == 0);
+
+  reap_children();
+
+  CU_ASSERT(get_child_status(pid, &status, NULL));
+  CU_ASSERT(WIFSIGNALED(status));
+  CU_ASSERT(WTERMSIG(status) == SIGUSR1);
+
+  CU_ASSERT(child.pid != pid);
+  CU_ASSERT(child.pid > 0);
+
+  ensure_death(child.pid);
+}
+
 CU_TestInfo process_tests[] = {
   { "test_wait_for_death", test_wait_for_death },
+  { "test_wait_for_deaths", test_wait_for_deaths },
   { "test_ensure_death", test_ensure_death },
+  { "test_ensure_deaths", test_ensure_deaths },
   { "test_create_child_function", test_create_child_function },
   { "test_create_child_process", test_create_child_process },
+  { "test_create_child_closes_fds", test_create_child_closes_fds },
+  { "test_get_child_status", test_get_child_status },
+  { "test_reap_children_restarts", test_reap_children_restarts },
   CU_TEST_INFO_NULL,
 };
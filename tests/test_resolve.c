@@ -0,0 +1,436 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include <CUnit/CUnit.h>
+
+#include "plugin.h"
+#include "resolve.h"
+
+#include "test_resolve.h"
+
+/* plugin.c is not linked into the tests. */
+GQuark vlock_plugin_error_quark(void)
+{
+  return g_quark_from_static_string("vlock-plugin-error-quark");
+}
+
+/* A fake plugin. */
+struct test_plugin
+{
+  const char *name;
+  GList *dependencies[nr_dependencies];
+  bool loadable;
+};
+
+#define MAX_TEST_PLUGINS 16
+
+/* All plugins that may be loaded. */
+static struct test_plugin test_plugins[MAX_TEST_PLUGINS];
+static size_t nr_test_plugins;
+static size_t nr_unloaded;
+
+static const char *get_test_name(void *plugin)
+{
+  return ((struct test_plugin *)plugin)->name;
+}
+
+static GList *get_test_dependencies(void *plugin, size_t dependency)
+{
+  return ((struct test_plugin *)plugin)->dependencies[dependency];
+}
+
+static void *load_test_plugin(const char *name)
+{
+  for (size_t i = 0; i < nr_test_plugins; i++)
+    if (strcmp(test_plugins[i].name, name) == 0)
+      return test_plugins[i].loadable ? &test_plugins[i] : NULL;
+
+  return NULL;
+}
+
+static void unload_test_plugin(void __attribute__((unused)) *plugin)
+{
+  nr_unloaded++;
+}
+
+static const struct resolve_ops test_ops = {
+  get_test_name,
+  get_test_dependencies,
+  load_test_plugin,
+  unload_test_plugin,
+};
+
+/* Set up test plugins named "a", "b", ... */
+static void init_test_plugins(size_t n)
+{
+  static const char *names[MAX_TEST_PLUGINS] = {
+    "a", "b", "c", "d", "e", "f", "g", "h",
+    "i", "j", "k", "l", "m", "n", "o", "p",
+  };
+
+  g_assert(n <= MAX_TEST_PLUGINS);
+
+  for (size_t i = 0; i < n; i++) {
+    test_plugins[i].name = g_intern_string(names[i]);
+    test_plugins[i].loadable = true;
+
+    for (size_t j = 0; j < nr_dependencies; j++)
+      test_plugins[i].dependencies[j] = NULL;
+  }
+
+  nr_test_plugins = n;
+  nr_unloaded = 0;
+}
+
+static void clear_test_plugins(void)
+{
+  for (size_t i = 0; i < nr_test_plugins; i++)
+    for (size_t j = 0; j < nr_dependencies; j++)
+      g_list_free(test_plugins[i].dependencies[j]);
+
+  nr_test_plugins = 0;
+}
+
+static void add_dependency(size_t plugin, size_t dependency, const char *name)
+{
+  GList **list = &test_plugins[plugin].dependencies[dependency];
+
+  *list = g_list_append(*list, (gpointer) g_intern_string(name));
+}
+
+/* The dependency resolution as it was done before resolve_plugins(), with a
+ * linear search for each dependency and a list of required plugins. */
+
+static void *reference_get_plugin(GList *plugins,
+                                  const char *name,
+                                  const struct resolve_ops *ops)
+{
+  for (GList *item = plugins; item != NULL; item = g_list_next(item))
+    if (strcmp(name, ops->get_name(item->data)) == 0)
+      return item->data;
+
+  return NULL;
+}
+
+static void *reference_load_plugin(GList **plugins,
+                                   const char *name,
+                                   const struct resolve_ops *ops)
+{
+  void *p = reference_get_plugin(*plugins, name, ops);
+
+  if (p == NULL) {
+    p = ops->load(name);
+
+    if (p != NULL)
+      *plugins = g_list_append(*plugins, p);
+  }
+
+  return p;
+}
+
+static bool reference_resolve(GPtrArray *plugin_array,
+                              const struct resolve_ops *ops,
+                              GError **error)
+{
+  GList *plugins = NULL;
+  GList *required_plugins = NULL;
+  bool result = false;
+
+  for (size_t i = 0; i < plugin_array->len; i++)
+    plugins = g_list_append(plugins, g_ptr_array_index(plugin_array, i));
+
+  for (GList *plugin_item = plugins;
+       plugin_item != NULL;
+       plugin_item = g_list_next(plugin_item)) {
+    void *p = plugin_item->data;
+
+    for (GList *dependency_item = ops->get_dependencies(p, REQUIRES);
+         dependency_item != NULL;
+         dependency_item = g_list_next(dependency_item)) {
+      const char *d = dependency_item->data;
+      void *q = reference_load_plugin(&plugins, d, ops);
+
+      if (q == NULL) {
+        g_set_error(error, VLOCK_PLUGIN_ERROR, VLOCK_PLUGIN_ERROR_DEPENDENCY,
+                    "'%s' requires '%s' which could not be loaded",
+                    ops->get_name(p), d);
+        goto out;
+      }
+
+      required_plugins = g_list_append(required_plugins, p);
+    }
+  }
+
+  for (GList *plugin_item = plugins;
+       plugin_item != NULL;
+       plugin_item = g_list_next(plugin_item)) {
+    void *p = plugin_item->data;
+
+    for (GList *dependency_item = ops->get_dependencies(p, NEEDS);
+         dependency_item != NULL;
+         dependency_item = g_list_next(dependency_item)) {
+      const char *d = dependency_item->data;
+      void *q = reference_get_plugin(plugins, d, ops);
+
+      if (q == NULL) {
+        g_set_error(error, VLOCK_PLUGIN_ERROR, VLOCK_PLUGIN_ERROR_DEPENDENCY,
+                    "'%s' needs '%s' which is not loaded",
+                    ops->get_name(p), d);
+        goto out;
+      }
+
+      required_plugins = g_list_append(required_plugins, q);
+    }
+  }
+
+  for (GList *plugin_item = plugins; plugin_item != NULL; ) {
+    void *p = plugin_item->data;
+    bool dependencies_loaded = true;
+
+    for (GList *dependency_item = ops->get_dependencies(p, DEPENDS);
+         dependency_item != NULL;
+         dependency_item = g_list_next(dependency_item)) {
+      const char *d = dependency_item->data;
+
+      if (reference_get_plugin(plugins, d, ops) == NULL) {
+        dependencies_loaded = false;
+
+        if (g_list_find(required_plugins, p) != NULL) {
+          g_set_error(error, VLOCK_PLUGIN_ERROR, VLOCK_PLUGIN_ERROR_DEPENDENCY,
+                      "'%s' is required by some other plugin but depends on '%s' which is not loaded",
+                      ops->get_name(p), d);
+          goto out;
+        }
+
+        break;
+      }
+    }
+
+    GList *next_plugin_item = g_list_next(plugin_item);
+
+    if (!dependencies_loaded) {
+      ops->unload(p);
+      plugins = g_list_delete_link(plugins, plugin_item);
+    }
+
+    plugin_item = next_plugin_item;
+  }
+
+  for (GList *plugin_item = plugins;
+       plugin_item != NULL;
+       plugin_item = g_list_next(plugin_item)) {
+    void *p = plugin_item->data;
+
+    for (GList *dependency_item = ops->get_dependencies(p, CONFLICTS);
+         dependency_item != NULL;
+         dependency_item = g_list_next(dependency_item)) {
+      const char *d = dependency_item->data;
+
+      if (reference_get_plugin(plugins, d, ops) != NULL) {
+        g_set_error(error, VLOCK_PLUGIN_ERROR, VLOCK_PLUGIN_ERROR_DEPENDENCY,
+                    "'%s' and '%s' cannot be loaded at the same time",
+                    ops->get_name(p), d);
+        goto out;
+      }
+    }
+  }
+
+  g_ptr_array_set_size(plugin_array, 0);
+
+  for (GList *item = plugins; item != NULL; item = g_list_next(item))
+    g_ptr_array_add(plugin_array, item->data);
+
+  result = true;
+
+out:
+  g_list_free(required_plugins);
+  g_list_free(plugins);
+
+  return result;
+}
+
+/* Create an array of the given test plugins. */
+static GPtrArray *get_test_array(const size_t indices[], size_t n)
+{
+  GPtrArray *plugins = g_ptr_array_new();
+
+  for (size_t i = 0; i < n; i++)
+    g_ptr_array_add(plugins, &test_plugins[indices[i]]);
+
+  return plugins;
+}
+
+void test_resolve_requires(void)
+{
+  size_t initial[] = { 0 };
+  GPtrArray *plugins;
+  GError *error = NULL;
+
+  init_test_plugins(4);
+
+  /* a requires b, b requires c */
+  add_dependency(0, REQUIRES, "b");
+  add_dependency(1, REQUIRES, "c");
+
+  plugins = get_test_array(initial, 1);
+
+  CU_ASSERT(resolve_plugins(plugins, &test_ops, &error));
+  CU_ASSERT_PTR_NULL(error);
+  CU_ASSERT_EQUAL(plugins->len, 3);
+  CU_ASSERT_PTR_EQUAL(g_ptr_array_index(plugins, 1), &test_plugins[1]);
+  CU_ASSERT_PTR_EQUAL(g_ptr_array_index(plugins, 2), &test_plugins[2]);
+
+  g_ptr_array_free(plugins, true);
+
+  /* b also requires d which cannot be loaded */
+  add_dependency(1, REQUIRES, "d");
+  test_plugins[3].loadable = false;
+
+  plugins = get_test_array(initial, 1);
+
+  CU_ASSERT(!resolve_plugins(plugins, &test_ops, &error));
+  CU_ASSERT(g_error_matches(error,
+                            VLOCK_PLUGIN_ERROR,
+                            VLOCK_PLUGIN_ERROR_DEPENDENCY));
+
+  g_clear_error(&error);
+  g_ptr_array_free(plugins, true);
+  clear_test_plugins();
+}
+
+void test_resolve_depends(void)
+{
+  size_t initial[] = { 0, 1, 2 };
+  GPtrArray *plugins;
+  GError *error = NULL;
+
+  init_test_plugins(4);
+
+  /* a depends on d which is not loaded, b depends on a, c conflicts with a */
+  add_dependency(0, DEPENDS, "d");
+  add_dependency(1, DEPENDS, "a");
+  add_dependency(2, CONFLICTS, "a");
+
+  plugins = get_test_array(initial, 3);
+
+  /* a and b are dropped, c does not conflict anymore. */
+  CU_ASSERT(resolve_plugins(plugins, &test_ops, &error));
+  CU_ASSERT_PTR_NULL(error);
+  CU_ASSERT_EQUAL(plugins->len, 1);
+  CU_ASSERT_PTR_EQUAL(g_ptr_array_index(plugins, 0), &test_plugins[2]);
+  CU_ASSERT_EQUAL(nr_unloaded, 2);
+
+  g_ptr_array_free(plugins, true);
+
+  /* A plugin that is needed must not be dropped. */
+  add_dependency(2, NEEDS, "b");
+
+  plugins = get_test_array(initial, 3);
+
+  CU_ASSERT(!resolve_plugins(plugins, &test_ops, &error));
+  CU_ASSERT(g_error_matches(error,
+                            VLOCK_PLUGIN_ERROR,
+                            VLOCK_PLUGIN_ERROR_DEPENDENCY));
+
+  g_clear_error(&error);
+  g_ptr_array_free(plugins, true);
+  clear_test_plugins();
+}
+
+/* Fill the test plugins with random dependencies. */
+static void init_random_plugins(GRand *rand)
+{
+  static const char *unknown_names[] = { "x", "y" };
+  size_t n = g_rand_int_range(rand, 1, MAX_TEST_PLUGINS + 1);
+
+  init_test_plugins(n);
+
+  for (size_t i = 0; i < n; i++) {
+    test_plugins[i].loadable = g_rand_int_range(rand, 0, 5) > 0;
+
+    for (size_t j = REQUIRES; j < nr_dependencies; j++) {
+      size_t nr_items = g_rand_int_range(rand, 0, 12);
+
+      /* Most dependency lists are empty. */
+      if (nr_items > 2)
+        nr_items = 0;
+
+      for (size_t k = 0; k < nr_items; k++) {
+        if (g_rand_int_range(rand, 0, 8) == 0)
+          add_dependency(i, j, unknown_names[g_rand_int_range(rand, 0, 2)]);
+        else
+          add_dependency(i, j, test_plugins[g_rand_int_range(rand, 0, n)].name);
+      }
+    }
+  }
+}
+
+/* Compare the results of resolve_plugins() and the reference on random
+ * plugin sets. */
+void test_resolve_equivalence(void)
+{
+  GRand *rand = g_rand_new_with_seed(42);
+
+  for (size_t round = 0; round < 5000; round++) {
+    size_t initial[MAX_TEST_PLUGINS];
+    size_t nr_initial = 0;
+    GPtrArray *plugins;
+    GPtrArray *reference_plugins;
+    GError *error = NULL;
+    GError *reference_error = NULL;
+    bool result;
+    bool reference_result;
+
+    init_random_plugins(rand);
+
+    /* Start with a random subset in random order. */
+    for (size_t i = 0; i < nr_test_plugins; i++)
+      if (g_rand_int_range(rand, 0, 2) == 0)
+        initial[nr_initial++] = i;
+
+    for (size_t i = nr_initial; i > 1; i--) {
+      size_t j = g_rand_int_range(rand, 0, i);
+      size_t tmp = initial[i - 1];
+
+      initial[i - 1] = initial[j];
+      initial[j] = tmp;
+    }
+
+    plugins = get_test_array(initial, nr_initial);
+    reference_plugins = get_test_array(initial, nr_initial);
+
+    result = resolve_plugins(plugins, &test_ops, &error);
+    reference_result = reference_resolve(reference_plugins,
+                                         &test_ops,
+                                         &reference_error);
+
+    CU_ASSERT_EQUAL(result, reference_result);
+
+    if (result && reference_result) {
+      CU_ASSERT_EQUAL(plugins->len, reference_plugins->len);
+
+      for (size_t i = 0; i < plugins->len && i < reference_plugins->len; i++)
+        CU_ASSERT_PTR_EQUAL(g_ptr_array_index(plugins, i),
+                            g_ptr_array_index(reference_plugins, i));
+    } else if (!result && !reference_result) {
+      CU_ASSERT_STRING_EQUAL(error->message, reference_error->message);
+    }
+
+    g_clear_error(&error);
+    g_clear_error(&reference_error);
+    g_ptr_array_free(plugins, true);
+    g_ptr_array_free(reference_plugins, true);
+    clear_test_plugins();
+  }
+
+  g_rand_free(rand);
+}
+
+CU_TestInfo resolve_tests[] = {
+  { "test_resolve_requires", test_resolve_requires },
+  { "test_resolve_depends", test_resolve_depends },
+  { "test_resolve_equivalence", test_resolve_equivalence },
+  CU_TEST_INFO_NULL,
+};
@@ -0,0 +1 @@
+extern CU_TestInfo resolve_tests[];
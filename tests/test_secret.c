@@ -0,0 +1,100 @@
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <CUnit/CUnit.h>
+
+#include "secret.h"
+
+#include "test_secret.h"
+
+void test_secret_map(void)
+{
+  size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+  char *memory = secret_map(1);
+
+  CU_ASSERT_PTR_NOT_NULL_FATAL(memory);
+  CU_ASSERT((uintptr_t) memory % page_size == 0);
+
+  /* The whole page is usable. */
+  memset(memory, 'x', page_size);
+  CU_ASSERT(memory[page_size - 1] == 'x');
+
+  secret_wipe(memory, page_size);
+  CU_ASSERT(memory[0] == '\0' && memory[page_size - 1] == '\0');
+
+  secret_unmap(memory, 1);
+}
+
+void test_secret_alloc(void)
+{
+  char *first = secret_alloc(10);
+  char *second = secret_alloc(100);
+  char *third;
+
+  CU_ASSERT_PTR_NOT_NULL_FATAL(first);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(second);
+  CU_ASSERT(second >= first + 10);
+  CU_ASSERT(first[0] == '\0');
+
+  strcpy(first, "secret");
+  strcpy(second, "password");
+
+  /* Memory that is given back is wiped and reused while other secrets are
+   * still live. */
+  secret_free(first);
+  third = secret_alloc(10);
+  CU_ASSERT(third == first);
+  CU_ASSERT(third[0] == '\0');
+  CU_ASSERT(strcmp(second, "password") == 0);
+
+  secret_free(second);
+  secret_free(third);
+  secret_free(NULL);
+
+  /* The arena is bounded. */
+  CU_ASSERT_PTR_NULL(secret_alloc(1024 * 1024));
+}
+
+void test_secret_free_out_of_order(void)
+{
+  char *live = secret_alloc(32);
+  char *secrets[8];
+
+  CU_ASSERT_PTR_NOT_NULL_FATAL(live);
+  strcpy(live, "still in use");
+
+  /* Allocating and freeing a lot more than fits into the arena at once must
+   * not exhaust it while one secret stays live. */
+  for (size_t round = 0; round < 1000; round++) {
+    for (size_t i = 0; i < 8; i++) {
+      secrets[i] = secret_alloc(512);
+      CU_ASSERT_PTR_NOT_NULL_FATAL(secrets[i]);
+      CU_ASSERT(secrets[i][0] == '\0' && secrets[i][511] == '\0');
+      memset(secrets[i], 'x', 512);
+    }
+
+    /* Free every other secret first so that the gaps have to be merged. */
+    for (size_t i = 0; i < 8; i += 2)
+      secret_free(secrets[(i + round) % 8]);
+
+    for (size_t i = 1; i < 8; i += 2)
+      secret_free(secrets[(i + round) % 8]);
+  }
+
+  CU_ASSERT(strcmp(live, "still in use") == 0);
+
+  /* The merged space can be handed out as a whole. */
+  secrets[0] = secret_alloc(8 * 1024);
+  CU_ASSERT_PTR_NOT_NULL(secrets[0]);
+
+  secret_free(secrets[0]);
+  secret_free(live);
+}
+
+CU_TestInfo secret_tests[] = {
+  { "test_secret_map", test_secret_map },
+  { "test_secret_alloc", test_secret_alloc },
+  { "test_secret_free_out_of_order", test_secret_free_out_of_order },
+  CU_TEST_INFO_NULL,
+};
@@ -0,0 +1 @@
+extern CU_TestInfo secret_tests[];
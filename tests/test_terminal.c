@@ -0,0 +1,130 @@
+#if !defined(__FreeBSD__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+
+#include <CUnit/CUnit.h>
+
+#include "terminal.h"
+
+#include "test_terminal.h"
+
+/* Open a new pseudo terminal and return the file descriptor of its slave.
+ * The master is stored in the given location. */
+static int open_pty(int *master)
+{
+  int slave;
+
+  *master = posix_openpt(O_RDWR | O_NOCTTY);
+
+  if (*master < 0)
+    return -1;
+
+  if (grantpt(*master) < 0 || unlockpt(*master) < 0)
+    goto error;
+
+  slave = open(ptsname(*master), O_RDWR | O_NOCTTY);
+
+  if (slave < 0)
+    goto error;
+
+  return slave;
+
+error:
+  (void) close(*master);
+  return -1;
+}
+
+static tcflag_t get_lflag(int fd)
+{
+  struct termios term;
+
+  CU_ASSERT(tcgetattr(fd, &term) == 0);
+
+  return term.c_lflag;
+}
+
+void test_terminal_mode(void)
+{
+  int master;
+  int slave = open_pty(&master);
+  tcflag_t lflag;
+  struct termios term;
+
+  CU_ASSERT_FATAL(slave >= 0);
+
+  lflag = get_lflag(slave);
+  CU_ASSERT((lflag & (ECHO | ICANON | ISIG)) == (ECHO | ICANON | ISIG));
+
+  set_terminal(slave);
+
+  /* Changes take effect when they are applied. */
+  push_terminal_mode(ICANON | ECHO);
+  CU_ASSERT(get_lflag(slave) == lflag);
+  CU_ASSERT(apply_terminal_mode());
+  CU_ASSERT(get_lflag(slave) == (lflag & ~(ICANON | ECHO)));
+
+  CU_ASSERT(tcgetattr(slave, &term) == 0);
+  CU_ASSERT(term.c_cc[VMIN] == 1);
+  CU_ASSERT(term.c_cc[VTIME] == 0);
+
+  /* Nothing changes if the same mode is pushed again. */
+  CU_ASSERT(!apply_terminal_mode());
+  pop_terminal_mode();
+  push_terminal_mode(ECHO | ICANON);
+  CU_ASSERT(!apply_terminal_mode());
+
+  /* Modes accumulate. */
+  push_terminal_mode(ISIG);
+  CU_ASSERT(apply_terminal_mode());
+  CU_ASSERT(get_lflag(slave) == (lflag & ~(ICANON | ECHO | ISIG)));
+
+  pop_terminal_mode();
+  CU_ASSERT(apply_terminal_mode());
+  CU_ASSERT(get_lflag(slave) == (lflag & ~(ICANON | ECHO)));
+
+  restore_terminal();
+  CU_ASSERT(get_lflag(slave) == lflag);
+  CU_ASSERT(!apply_terminal_mode());
+
+  set_terminal(STDIN_FILENO);
+  (void) close(slave);
+  (void) close(master);
+}
+
+void test_secure_terminal(void)
+{
+  int master;
+  int slave = open_pty(&master);
+  tcflag_t lflag;
+
+  CU_ASSERT_FATAL(slave >= 0);
+
+  lflag = get_lflag(slave);
+  set_terminal(slave);
+
+  secure_terminal();
+  CU_ASSERT(get_lflag(slave) == (lflag & ~(ECHO | ISIG)));
+
+  /* Line buffering is switched off on top of the secured mode. */
+  push_terminal_mode(ICANON);
+  CU_ASSERT(apply_terminal_mode());
+  CU_ASSERT(get_lflag(slave) == (lflag & ~(ECHO | ISIG | ICANON)));
+
+  restore_terminal();
+  CU_ASSERT(get_lflag(slave) == lflag);
+
+  set_terminal(STDIN_FILENO);
+  (void) close(slave);
+  (void) close(master);
+}
+
+CU_TestInfo terminal_tests[] = {
+  { "test_terminal_mode", test_terminal_mode },
+  { "test_secure_terminal", test_secure_terminal },
+  CU_TEST_INFO_NULL,
+};
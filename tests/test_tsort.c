@@ -131,8 +131,172 @@ void test_tsort_fail(void)
   g_list_free(list);
 }
 
+/* Nodes without incoming edges come in list order, successors in edge order. */
+void test_tsort_order(void)
+{
+  GList *list = get_test_list();
+  GList *edges = get_test_edges();
+  GList *sorted_list = tsort(list, &edges);
+  void *expected[] = { G, F, A, H, B, C, D, E };
+  size_t i = 0;
+
+  CU_ASSERT_PTR_NULL(edges);
+  CU_ASSERT_EQUAL(g_list_length(sorted_list), 8);
+
+  for (GList *item = sorted_list; item != NULL && i < 8; item = g_list_next(item))
+    CU_ASSERT_PTR_EQUAL(item->data, expected[i++]);
+
+  g_list_free(sorted_list);
+  g_list_free(list);
+}
+
+/* Check that the given edges form a circle in the given order. */
+static void assert_circle(GList *edges, void *circle[], size_t length)
+{
+  size_t i = 0;
+
+  CU_ASSERT_EQUAL(g_list_length(edges), length);
+
+  for (GList *item = edges; item != NULL && i < length; item = g_list_next(item)) {
+    struct edge *e = item->data;
+
+    CU_ASSERT_PTR_EQUAL(e->predecessor, circle[i]);
+    CU_ASSERT_PTR_EQUAL(e->successor, circle[(i + 1) % length]);
+    i++;
+  }
+}
+
+static void free_edges(GList *edges)
+{
+  while (edges != NULL) {
+    free(edges->data);
+    edges = g_list_delete_link(edges, edges);
+  }
+}
+
+void test_tsort_fail_circle(void)
+{
+  GList *list = get_test_list();
+  GList *edges = get_faulty_test_edges();
+  GList *sorted_list = tsort(list, &edges);
+  void *circle[] = { F, A, B, E };
+
+  CU_ASSERT_PTR_NULL(sorted_list);
+
+  /* Only the edges of the circle are left. */
+  assert_circle(edges, circle, 4);
+
+  free_edges(edges);
+  g_list_free(list);
+}
+
+void test_tsort_fail_shortest_circle(void)
+{
+  GList *list = get_test_list();
+  GList *edges = get_faulty_test_edges();
+  GList *sorted_list;
+  void *circle[] = { D, C };
+
+  /* Add a second, shorter circle. */
+  edges = g_list_append(edges, make_edge(C, D));
+  edges = g_list_append(edges, make_edge(D, C));
+
+  sorted_list = tsort(list, &edges);
+
+  CU_ASSERT_PTR_NULL(sorted_list);
+  assert_circle(edges, circle, 2);
+
+  free_edges(edges);
+  g_list_free(list);
+}
+
+void test_tsort_fail_unknown_node(void)
+{
+  GList *list = get_test_list();
+  GList *edges = get_test_edges();
+  GList *sorted_list;
+  struct edge *unknown = make_edge(A, (void *)9);
+
+  edges = g_list_append(edges, unknown);
+
+  sorted_list = tsort(list, &edges);
+
+  CU_ASSERT_PTR_NULL(sorted_list);
+  CU_ASSERT_EQUAL(g_list_length(edges), 1);
+  CU_ASSERT_PTR_EQUAL(g_list_nth_data(edges, 0), unknown);
+
+  free_edges(edges);
+  g_list_free(list);
+}
+
+#define LARGE_NODES 5000
+#define LARGE_EDGES 50000
+
+/* Sort a random graph with thousands of nodes. */
+void test_tsort_large(void)
+{
+  GList *list = NULL;
+  GList *edges = NULL;
+  GList *sorted_list;
+  GRand *rand = g_rand_new_with_seed(1);
+  size_t *position = g_new(size_t, LARGE_NODES + 1);
+  size_t i = 0;
+
+  for (size_t n = LARGE_NODES; n > 0; n--)
+    list = g_list_prepend(list, GSIZE_TO_POINTER(n));
+
+  /* Edges always point to higher numbers so there are no circles. */
+  for (size_t j = 0; j < LARGE_EDGES; j++) {
+    size_t p = g_rand_int_range(rand, 1, LARGE_NODES);
+    size_t s = g_rand_int_range(rand, p + 1, LARGE_NODES + 1);
+
+    edges = g_list_prepend(edges, make_edge(GSIZE_TO_POINTER(p),
+                                            GSIZE_TO_POINTER(s)));
+  }
+
+  sorted_list = tsort(list, &edges);
+
+  CU_ASSERT_PTR_NULL(edges);
+  CU_ASSERT_EQUAL(g_list_length(sorted_list), LARGE_NODES);
+
+  for (GList *item = sorted_list; item != NULL; item = g_list_next(item))
+    position[GPOINTER_TO_SIZE(item->data)] = i++;
+
+  /* Check the order against the same edges again. */
+  g_rand_set_seed(rand, 1);
+
+  for (size_t j = 0; j < LARGE_EDGES; j++) {
+    size_t p = g_rand_int_range(rand, 1, LARGE_NODES);
+    size_t s = g_rand_int_range(rand, p + 1, LARGE_NODES + 1);
+
+    CU_ASSERT(position[p] < position[s]);
+  }
+
+  /* Close a circle through all nodes. */
+  edges = NULL;
+
+  for (size_t n = 1; n <= LARGE_NODES; n++)
+    edges = g_list_prepend(edges,
+                           make_edge(GSIZE_TO_POINTER(n),
+                                     GSIZE_TO_POINTER(n % LARGE_NODES + 1)));
+
+  CU_ASSERT_PTR_NULL(tsort(list, &edges));
+  CU_ASSERT_EQUAL(g_list_length(edges), LARGE_NODES);
+
+  free_edges(edges);
+  g_free(position);
+  g_rand_free(rand);
+  g_list_free(sorted_list);
+  g_list_free(list);
+}
+
 CU_TestInfo tsort_tests[] = {
   { "test_tsort_succeed", test_tsort_succeed },
   { "test_tsort_fail", test_tsort_fail },
+  { "test_tsort_order", test_tsort_order },
+  { "test_tsort_fail_circle", test_tsort_fail_circle },
+  { "test_tsort_fail_shortest_circle", test_tsort_fail_shortest_circle },
+  { "test_tsort_fail_unknown_node", test_tsort_fail_unknown_node },
+  { "test_tsort_large", test_tsort_large },
   CU_TEST_INFO_NULL,
 };
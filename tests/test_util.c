@@ -1,6 +1,9 @@
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
+#include <glib.h>
+
 #include <CUnit/CUnit.h>
 
 #include "util.h"
@@ -34,7 +37,40 @@ void test_parse_timespec(void)
   CU_ASSERT_PTR_NULL(parse_seconds("hello"));
 }
 
+void test_ring_buffer(void)
+{
+  struct ring_buffer *buffer = ring_buffer_new(8);
+  char *contents;
+
+  contents = ring_buffer_dup(buffer);
+  CU_ASSERT_STRING_EQUAL(contents, "");
+  g_free(contents);
+
+  ring_buffer_append(buffer, "hello", 5);
+  contents = ring_buffer_dup(buffer);
+  CU_ASSERT_STRING_EQUAL(contents, "hello");
+  CU_ASSERT(buffer->dropped == 0);
+  g_free(contents);
+
+  /* Wrap around. */
+  ring_buffer_append(buffer, "world", 5);
+  contents = ring_buffer_dup(buffer);
+  CU_ASSERT_STRING_EQUAL(contents, "lloworld");
+  CU_ASSERT(buffer->dropped == 2);
+  g_free(contents);
+
+  /* More than fits at once. */
+  ring_buffer_append(buffer, "0123456789", 10);
+  contents = ring_buffer_dup(buffer);
+  CU_ASSERT_STRING_EQUAL(contents, "23456789");
+  CU_ASSERT(buffer->dropped == 2 + 10);
+  g_free(contents);
+
+  ring_buffer_free(buffer);
+}
+
 CU_TestInfo util_tests[] = {
   { "test_parse_timespec", test_parse_timespec },
+  { "test_ring_buffer", test_ring_buffer },
   CU_TEST_INFO_NULL,
 };
@@ -0,0 +1,327 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include <glib.h>
+
+#include "plugin.h"
+#include "tsort.h"
+#include "resolve.h"
+#include "process.h"
+
+/* plugin.c is not linked into the benchmarks. */
+GQuark vlock_plugin_error_quark(void)
+{
+  return g_quark_from_static_string("vlock-plugin-error-quark");
+}
+
+/* Run the given function repeatedly for at least a second and print the
+ * average time per run. */
+static void report(const char *name, void (*function)(void *), void *data)
+{
+  GTimer *timer = g_timer_new();
+  unsigned int runs = 0;
+  double elapsed;
+
+  do {
+    function(data);
+    runs++;
+  } while ((elapsed = g_timer_elapsed(timer, NULL)) < 1.0);
+
+  printf("%-40s %10u runs %12.3f us/run\n", name, runs, elapsed * 1e6 / runs);
+
+  g_timer_destroy(timer);
+}
+
+/*********/
+/* tsort */
+/*********/
+
+struct tsort_graph
+{
+  size_t nr_nodes;
+  size_t nr_edges;
+  size_t *predecessors;
+  size_t *successors;
+  GList *nodes;
+};
+
+static void run_tsort(void *data)
+{
+  struct tsort_graph *g = data;
+  GList *edges = NULL;
+  GList *sorted_nodes;
+
+  for (size_t i = g->nr_edges; i > 0; i--)
+    edges = g_list_prepend(edges,
+                           make_edge(GSIZE_TO_POINTER(g->predecessors[i-1]),
+                                     GSIZE_TO_POINTER(g->successors[i-1])));
+
+  sorted_nodes = tsort(g->nodes, &edges);
+
+  if (sorted_nodes == NULL) {
+    fprintf(stderr, "vlock-bench: tsort failed\n");
+    exit(EXIT_FAILURE);
+  }
+
+  g_list_free(sorted_nodes);
+}
+
+/* Sort random acyclic graphs of different sizes. */
+static void bench_tsort(void)
+{
+  size_t sizes[] = { 100, 1000, 10000 };
+
+  for (size_t i = 0; i < G_N_ELEMENTS(sizes); i++) {
+    struct tsort_graph g;
+    GRand *rand = g_rand_new_with_seed(i);
+    gchar *name;
+
+    g.nr_nodes = sizes[i];
+    g.nr_edges = 4 * sizes[i];
+    g.predecessors = g_new(size_t, g.nr_edges);
+    g.successors = g_new(size_t, g.nr_edges);
+    g.nodes = NULL;
+
+    for (size_t n = g.nr_nodes; n > 0; n--)
+      g.nodes = g_list_prepend(g.nodes, GSIZE_TO_POINTER(n));
+
+    /* Edges always point to higher numbers so there are no circles. */
+    for (size_t j = 0; j < g.nr_edges; j++) {
+      g.predecessors[j] = g_rand_int_range(rand, 1, g.nr_nodes);
+      g.successors[j] = g_rand_int_range(rand, g.predecessors[j] + 1,
+                                         g.nr_nodes + 1);
+    }
+
+    name = g_strdup_printf("tsort %zu nodes %zu edges", g.nr_nodes, g.nr_edges);
+    report(name, run_tsort, &g);
+
+    g_free(name);
+    g_list_free(g.nodes);
+    g_free(g.successors);
+    g_free(g.predecessors);
+    g_rand_free(rand);
+  }
+}
+
+/***********/
+/* resolve */
+/***********/
+
+struct bench_plugin
+{
+  const char *name;
+  GList *dependencies[nr_dependencies];
+};
+
+struct bench_plugin_set
+{
+  size_t nr_plugins;
+  size_t nr_initial;
+  struct bench_plugin *plugins;
+  GHashTable *by_name;
+};
+
+static struct bench_plugin_set *current_set;
+
+static const char *get_bench_name(void *plugin)
+{
+  return ((struct bench_plugin *)plugin)->name;
+}
+
+static GList *get_bench_dependencies(void *plugin, size_t dependency)
+{
+  return ((struct bench_plugin *)plugin)->dependencies[dependency];
+}
+
+static void *load_bench_plugin(const char *name)
+{
+  return g_hash_table_lookup(current_set->by_name, name);
+}
+
+static void unload_bench_plugin(void __attribute__((unused)) *plugin)
+{
+}
+
+static const struct resolve_ops bench_ops = {
+  get_bench_name,
+  get_bench_dependencies,
+  load_bench_plugin,
+  unload_bench_plugin,
+};
+
+static void run_resolve(void *data)
+{
+  struct bench_plugin_set *set = data;
+  GPtrArray *plugins = g_ptr_array_new();
+  GError *error = NULL;
+
+  for (size_t i = 0; i < set->nr_initial; i++)
+    g_ptr_array_add(plugins, &set->plugins[i]);
+
+  current_set = set;
+
+  if (!resolve_plugins(plugins, &bench_ops, &error)) {
+    fprintf(stderr, "vlock-bench: resolving failed: %s\n", error->message);
+    exit(EXIT_FAILURE);
+  }
+
+  g_ptr_array_free(plugins, true);
+}
+
+/* Resolve random plugin sets of different sizes.  Half of the plugins are
+ * loaded initially, the others are pulled in through "requires". */
+static void bench_resolve(void)
+{
+  size_t sizes[] = { 100, 1000, 10000 };
+
+  for (size_t i = 0; i < G_N_ELEMENTS(sizes); i++) {
+    struct bench_plugin_set set;
+    GRand *rand = g_rand_new_with_seed(i);
+    size_t n = sizes[i];
+    gchar *name;
+
+    set.nr_plugins = n;
+    set.nr_initial = n / 2;
+    set.plugins = g_new0(struct bench_plugin, n);
+    set.by_name = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+    for (size_t j = 0; j < n; j++) {
+      name = g_strdup_printf("plugin%zu", j);
+      set.plugins[j].name = g_intern_string(name);
+      g_hash_table_insert(set.by_name, (gpointer) set.plugins[j].name,
+                          &set.plugins[j]);
+      g_free(name);
+    }
+
+    for (size_t j = 0; j < n; j++) {
+      struct bench_plugin *p = &set.plugins[j];
+
+      /* Each plugin in the second half is required by one in the first. */
+      if (j < n / 2)
+        p->dependencies[REQUIRES] = g_list_prepend(NULL,
+          (gpointer) set.plugins[j + n / 2].name);
+
+      for (size_t k = 0; k < 2 && j > 0; k++) {
+        size_t d = g_rand_int_range(rand, 0, j);
+
+        p->dependencies[NEEDS] = g_list_prepend(p->dependencies[NEEDS],
+          (gpointer) set.plugins[d].name);
+        p->dependencies[DEPENDS] = g_list_prepend(p->dependencies[DEPENDS],
+          (gpointer) set.plugins[d].name);
+      }
+
+      p->dependencies[CONFLICTS] = g_list_prepend(NULL,
+        (gpointer) g_intern_string("not-loaded"));
+    }
+
+    name = g_strdup_printf("resolve %zu plugins", n);
+    report(name, run_resolve, &set);
+    g_free(name);
+
+    for (size_t j = 0; j < n; j++)
+      for (size_t k = 0; k < nr_dependencies; k++)
+        g_list_free(set.plugins[j].dependencies[k]);
+
+    g_hash_table_destroy(set.by_name);
+    g_free(set.plugins);
+    g_rand_free(rand);
+  }
+}
+
+/*********/
+/* spawn */
+/*********/
+
+static void run_spawn(void __attribute__((unused)) *data)
+{
+  const char *argv[] = { "/bin/true", NULL };
+  struct child_process child = {
+    .path = "/bin/true",
+    .argv = argv,
+    .stdin_fd = REDIRECT_DEV_NULL,
+    .stdout_fd = REDIRECT_DEV_NULL,
+    .stderr_fd = REDIRECT_DEV_NULL,
+    .function = NULL,
+  };
+  GError *error = NULL;
+
+  if (!create_child(&child, &error)) {
+    fprintf(stderr, "vlock-bench: spawning failed: %s\n", error->message);
+    exit(EXIT_FAILURE);
+  }
+
+  (void) waitpid(child.pid, NULL, 0);
+}
+
+/* Spawn a child process with different limits on the number of file
+ * descriptors.  The child closes all descriptors it does not need. */
+static void bench_spawn(void)
+{
+  rlim_t limits[] = { 1024, 65536, 1048576 };
+  struct rlimit original;
+
+  if (getrlimit(RLIMIT_NOFILE, &original) < 0) {
+    perror("vlock-bench: getrlimit");
+    return;
+  }
+
+  for (size_t i = 0; i < G_N_ELEMENTS(limits); i++) {
+    struct rlimit r = original;
+    gchar *name;
+
+    if (original.rlim_max != RLIM_INFINITY && limits[i] > original.rlim_max) {
+      printf("%-40s skipped, hard limit is %lu\n", "spawn",
+             (unsigned long) original.rlim_max);
+      continue;
+    }
+
+    r.rlim_cur = limits[i];
+
+    if (setrlimit(RLIMIT_NOFILE, &r) < 0) {
+      perror("vlock-bench: setrlimit");
+      continue;
+    }
+
+    name = g_strdup_printf("spawn with %lu descriptors",
+                           (unsigned long) limits[i]);
+    report(name, run_spawn, NULL);
+    g_free(name);
+  }
+
+  (void) setrlimit(RLIMIT_NOFILE, &original);
+}
+
+struct benchmark
+{
+  const char *name;
+  void (*run)(void);
+};
+
+static const struct benchmark benchmarks[] = {
+  { "tsort", bench_tsort },
+  { "resolve", bench_resolve },
+  { "spawn", bench_spawn },
+  { NULL, NULL },
+};
+
+/* Run all benchmarks or those given on the command line. */
+int main(int argc, const char *argv[])
+{
+  for (size_t i = 0; benchmarks[i].name != NULL; i++) {
+    bool selected = (argc < 2);
+
+    for (int j = 1; j < argc; j++)
+      if (strcmp(argv[j], benchmarks[i].name) == 0)
+        selected = true;
+
+    if (selected)
+      benchmarks[i].run();
+  }
+
+  exit(EXIT_SUCCESS);
+}
@@ -7,11 +7,17 @@
 #include "test_tsort.h"
 #include "test_util.h"
 #include "test_process.h"
+#include "test_resolve.h"
+#include "test_secret.h"
+#include "test_terminal.h"
 
 CU_SuiteInfo vlock_test_suites[] = {
   { "test_tsort", NULL, NULL, tsort_tests },
   { "test_util", NULL, NULL, util_tests },
   { "test_process", NULL, NULL, process_tests },
+  { "test_resolve", NULL, NULL, resolve_tests },
+  { "test_secret", NULL, NULL, secret_tests },
+  { "test_terminal", NULL, NULL, terminal_tests },
   CU_SUITE_INFO_NULL,
 };
 